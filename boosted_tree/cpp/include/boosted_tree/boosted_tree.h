@@ -4,6 +4,7 @@
 #include <cmath>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "./csr_matrix.h"
@@ -12,14 +13,42 @@ struct BoostedTreeParam {
   int max_depth = 6;
   float learning_rate = 0.3;  // eta
   int n_estimators = 100;
+  // ["reg:linear", "binary:logistic", "multi:softmax", "multi:softprob"]
   std::string objective = "reg:linear";
+  // the number of the classes of "multi:softmax" and "multi:softprob", whose
+  // labels are in [0, num_class), a round builds a tree per class
+  int num_class = 1;
   float reg_lambda = 1;
   float gamma = 0;
   int n_jobs = 1;
   int seed = 39;
-  std::string tree_method = "auto";  // ["auto", "exact", "approx"]
+  std::string tree_method = "auto";  // ["auto", "exact", "approx", "hist"]
   float sketch_eps = 0.03;
+  int max_bin = 255;  // the maximum number of bins per feature in "hist"
+  int max_cached_hist_node = 256;  // the capacity of the histogram cache
+  // bundle the sparse features which are rarely nonzero together in "hist",
+  // max_conflict_rate: the ratio of the rows with conflicts in a bundle
+  bool enable_bundle = false;
+  float max_conflict_rate = 0;
+  // the rows of a tree are sampled by "uniform" (the ratio subsample)
+  // or "goss" (gradient-based one-side sampling)
+  std::string sampling_method = "uniform";
   float subsample = 1.0;
+  float top_rate = 0.2;    // goss: the ratio of the large gradient rows
+  float other_rate = 0.1;  // goss: the ratio of the small gradient rows
+  // the ratios of the features sampled per tree, per level and per node
+  float colsample_bytree = 1.0;
+  float colsample_bylevel = 1.0;
+  float colsample_bynode = 1.0;
+  std::string grow_policy = "depthwise";  // ["depthwise", "lossguide"]
+  // the maximum number of leaves in "lossguide", 0: no limit
+  int max_leaves = 0;
+  // zeros, including the entries which are not stored, are missing values
+  bool zero_as_missing = false;
+  // stop if the loss of the last evaluation set doesn't decrease, 0: disabled
+  int early_stopping_rounds = 0;
+  // ["traversal", "quickscorer", "block", "compact"]
+  std::string predictor = "traversal";
 };
 /*
  * the samples will be groups per TREE_METHOD_APPROX_RATIO / sketch_eps samples,
@@ -28,12 +57,61 @@ struct BoostedTreeParam {
 const int TREE_METHOD_APPROX_RATIO = 100;
 
 class BoostedTree {
+ public:
+  using EvalData = std::pair<CSRMatrix<float>, Vec<float>>;
+
  public:
   BoostedTree(const BoostedTreeParam &);
   virtual ~BoostedTree();
-  void train(const CSRMatrix<float> &X, const Vec<float> &Y);
+  void train(const CSRMatrix<float> &X, const Vec<float> &Y,
+             const std::vector<EvalData> &eval_set = {});
+  /*
+   * a prediction per row, except num_class probabilities per row of
+   * "multi:softprob" (row-major)
+   */
   Vec<float> predict(const CSRMatrix<float> &X) const;
+  // the number of the predictions per row
+  int num_outputs() const;
+  /*
+   * the predictions of the trees [tree_begin, tree_end), the tree t of a
+   * multi-class model is of the class t % num_class
+   */
+  Vec<float> predict(const CSRMatrix<float> &X, const int tree_begin,
+                     const int tree_end) const;
+  /*
+   * the predictions of the first tree_end trees (-1: all the trees), the
+   * margins of X are cached by the storage of X, which is shared by its
+   * copies, so that only the trees after the cached ones are evaluated if
+   * tree_end grows. The cache of X is dropped if X is reset, freed, or has
+   * another number of stored entries, and the caches are cleared if the
+   * model is changed
+   */
+  Vec<float> predict_staged(const CSRMatrix<float> &X,
+                            const int tree_end = -1);
+  void clear_margin_cache();
+  /*
+   * 1 if the prediction >= threshold else 0, a row stops early once the rest
+   * trees can't change its decision
+   */
+  Vec<float> predict_label(const CSRMatrix<float> &X,
+                           const float threshold) const;
   std::string str() const;
+  // the C++ source of the model, see compiled_model.h
+  std::string export_cpp() const;
+  /*
+   * the binary model, load_model maps the file and predicts from it without
+   * copying the nodes, n_jobs and predictor aren't loaded
+   */
+  void save_model(const std::string &fname) const;
+  void load_model(const std::string &fname);
+  std::string save_raw() const;
+  void load_raw(const std::string &buf);
+  /*
+   * import the models of XGBoost (JSON) and LightGBM (text), the unstored
+   * entries are missing values in XGBoost, set zero_as_missing for them
+   */
+  void load_xgboost_model(const std::string &fname);
+  void load_lightgbm_model(const std::string &fname);
 
  public:
   static constexpr float MISSING_VALUE = nanf("");
@@ -0,0 +1,96 @@
+#ifndef BOOSTED_TREE_COMPILED_MODEL_H_
+#define BOOSTED_TREE_COMPILED_MODEL_H_
+
+#include <dlfcn.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "./csr_matrix.h"
+#include "./logging.h"
+#include "./vec.h"
+
+/*
+ * A model compiled from the source of BoostedTree::export_cpp
+ *
+ *   CompiledModel::compile(bst.export_cpp(), "model.so");
+ *   CompiledModel model("model.so");
+ *   Vec<float> preds = model.predict(X);
+ *
+ * The shared library only exports two C functions and doesn't depend on
+ * the training code:
+ *   int boosted_tree_num_features();
+ *   float boosted_tree_predict(const float *x);  // x is a dense row
+ */
+class CompiledModel {
+ public:
+  using PredictFunc = float (*)(const float *);
+  using NumFeaturesFunc = int (*)();
+
+ public:
+  // write source to lib_path + ".cpp" and compile it into lib_path
+  static bool compile(const std::string &source, const std::string &lib_path,
+                      const std::string &cxx = "c++") {
+    const std::string src_path = lib_path + ".cpp";
+    {
+      std::ofstream fout(src_path);
+      if (!fout.is_open()) {
+        LOG(INFO) << "Open file " << src_path << " fail! :(";
+        return false;
+      }
+      fout << source;
+    }
+    const std::string cmd = cxx + " -O2 -shared -fPIC -o \"" + lib_path +
+                            "\" \"" + src_path + "\"";
+    return std::system(cmd.c_str()) == 0;
+  }
+
+  explicit CompiledModel(const std::string &lib_path) {
+    handle_ = dlopen(lib_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    CHECK(handle_ != nullptr) << "Load " << lib_path << " fail: " << dlerror();
+    predict_ =
+        reinterpret_cast<PredictFunc>(dlsym(handle_, "boosted_tree_predict"));
+    NumFeaturesFunc num_features = reinterpret_cast<NumFeaturesFunc>(
+        dlsym(handle_, "boosted_tree_num_features"));
+    CHECK(predict_ != nullptr && num_features != nullptr)
+        << lib_path << " is not a compiled model";
+    num_features_ = num_features();
+  }
+  CompiledModel(const CompiledModel &) = delete;
+  CompiledModel &operator=(const CompiledModel &) = delete;
+  ~CompiledModel() {
+    if (handle_) dlclose(handle_);
+  }
+
+  Vec<float> predict(const CSRMatrix<float> &X) const {
+    const int N = X.length();
+    Vec<float> preds(N);
+    // the entries which are not stored are zeros
+    std::vector<float> dense(num_features_, 0);
+    for (int i = 0; i < N; ++i) {
+      const CSRRow<float> row = X[i];
+      const dim_t *indices = row.indices();
+      const float *values = row.values();
+      for (dim_t k = 0; k < row.nnz(); ++k) {
+        if (indices[k] < num_features_) dense[indices[k]] = values[k];
+      }
+      preds[i] = predict_(dense.data());
+      for (dim_t k = 0; k < row.nnz(); ++k) {
+        if (indices[k] < num_features_) dense[indices[k]] = 0;
+      }
+    }
+    return preds;
+  }
+
+  // the C function of the model
+  inline PredictFunc predict_func() const { return predict_; }
+
+ private:
+  void *handle_;
+  PredictFunc predict_;
+  int num_features_;
+};
+
+#endif
@@ -47,6 +47,10 @@ class CSRMatrix {
  public:
   CSRRow<T> operator[](dim_t row) const;
   dim_t length() const;
+  // the stored entries
+  dim_t nnz() const;
+  // the storage shared by the copies of the matrix, replaced by reset
+  std::weak_ptr<const CSRChunk<T>> storage() const;
 
  private:
   std::shared_ptr<CSRChunk<T>> data_;
@@ -64,6 +68,10 @@ class CSRRow {
   void set(dim_t col, const T &value);
   Vec<T> todense() const;
   dim_t length() const;
+  // the stored (non-zero) entries
+  dim_t nnz() const;
+  const dim_t *indices() const;
+  const T *values() const;
 
  public:
   template <typename U, typename VT>
@@ -113,6 +121,16 @@ dim_t CSRMatrix<T>::length() const {
   return rows_;
 }
 
+template <typename T>
+dim_t CSRMatrix<T>::nnz() const {
+  return data_ ? data_->offsets.back() : 0;
+}
+
+template <typename T>
+std::weak_ptr<const CSRChunk<T>> CSRMatrix<T>::storage() const {
+  return data_;
+}
+
 template <typename T>
 void CSRMatrix<T>::reset(const COOMatrix<T> &smat) {
   const COOChunk<T> &chunk = smat.data();
@@ -322,4 +340,19 @@ dim_t CSRRow<T>::length() const {
   return cols_;
 }
 
+template <typename T>
+dim_t CSRRow<T>::nnz() const {
+  return data_->offsets[row_ + 1] - data_->offsets[row_];
+}
+
+template <typename T>
+const dim_t *CSRRow<T>::indices() const {
+  return data_->indices.data() + data_->offsets[row_];
+}
+
+template <typename T>
+const T *CSRRow<T>::values() const {
+  return data_->values.data() + data_->offsets[row_];
+}
+
 #endif
@@ -0,0 +1,131 @@
+#ifndef BOOSTED_TREE_FAST_MATH_H_
+#define BOOSTED_TREE_FAST_MATH_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#ifndef BOOSTED_TREE_X86_SIMD
+#define BOOSTED_TREE_X86_SIMD
+#endif
+#include <immintrin.h>
+#endif
+
+/*
+ * exp(x) in float, the relative error is within 2 ulps
+ * x = n * ln2 + r, exp(x) = 2^n * exp(r), |r| <= ln2 / 2
+ * Reference: Cephes Math Library, expf.c
+ *
+ * The arrays run the same operations in the same order with AVX2, so their
+ * results are the same as FastExp and Sigmoid.
+ */
+namespace fast_math {
+constexpr float kExpLow = -87.0f;
+constexpr float kExpHigh = 88.0f;
+constexpr float kLog2e = 1.44269504088896341f;
+// ln2 = kLn2Hi - kLn2Lo
+constexpr float kLn2Hi = 0.693359375f;
+constexpr float kLn2Lo = 2.12194440e-4f;
+constexpr float kExpPoly[6] = {1.9875691500e-4f, 1.3981999507e-3f,
+                               8.3334519073e-3f, 4.1665795894e-2f,
+                               1.6666665459e-1f, 5.0000001201e-1f};
+}  // namespace fast_math
+
+inline float FastExp(float x) {
+  using namespace fast_math;
+  x = std::min(std::max(x, kExpLow), kExpHigh);
+  const float fx = x * kLog2e + 0.5f;
+  int n = static_cast<int>(fx);
+  n -= static_cast<float>(n) > fx;  // floor
+  const float fn = static_cast<float>(n);
+  const float r = x - fn * kLn2Hi + fn * kLn2Lo;
+  float y = kExpPoly[0];
+  for (int k = 1; k < 6; ++k) y = y * r + kExpPoly[k];
+  y = y * r * r + r + 1.0f;
+  const int32_t bits = (n + 127) << 23;
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return y * scale;
+}
+
+inline float Sigmoid(const float x) { return 1.0f / (1.0f + FastExp(-x)); }
+
+#ifdef BOOSTED_TREE_X86_SIMD
+// FastExp of 8 floats
+__attribute__((target("avx2"))) inline __m256 FastExpAVX2(__m256 v) {
+  using namespace fast_math;
+  // the NaNs are kept as std::max and std::min do
+  v = _mm256_min_ps(_mm256_set1_ps(kExpHigh),
+                    _mm256_max_ps(_mm256_set1_ps(kExpLow), v));
+  const __m256 fx = _mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(kLog2e)),
+                                  _mm256_set1_ps(0.5f));
+  __m256i ni = _mm256_cvttps_epi32(fx);
+  const __m256 gt = _mm256_cmp_ps(_mm256_cvtepi32_ps(ni), fx, _CMP_GT_OQ);
+  ni = _mm256_add_epi32(ni, _mm256_castps_si256(gt));
+  const __m256 fn = _mm256_cvtepi32_ps(ni);
+  const __m256 r = _mm256_add_ps(
+      _mm256_sub_ps(v, _mm256_mul_ps(fn, _mm256_set1_ps(kLn2Hi))),
+      _mm256_mul_ps(fn, _mm256_set1_ps(kLn2Lo)));
+  __m256 y = _mm256_set1_ps(kExpPoly[0]);
+  for (int k = 1; k < 6; ++k) {
+    y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(kExpPoly[k]));
+  }
+  y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(y, r), r), r),
+                    _mm256_set1_ps(1.0f));
+  const __m256 scale = _mm256_castsi256_ps(
+      _mm256_slli_epi32(_mm256_add_epi32(ni, _mm256_set1_epi32(127)), 23));
+  return _mm256_mul_ps(y, scale);
+}
+
+__attribute__((target("avx2"))) inline void ExpArrayAVX2(float *x,
+                                                         const int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(x + i, FastExpAVX2(_mm256_loadu_ps(x + i)));
+  }
+  for (; i < n; ++i) x[i] = FastExp(x[i]);
+}
+
+__attribute__((target("avx2"))) inline void SigmoidArrayAVX2(float *x,
+                                                             const int n) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 e =
+        FastExpAVX2(_mm256_xor_ps(_mm256_loadu_ps(x + i), sign));
+    _mm256_storeu_ps(x + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+  }
+  for (; i < n; ++i) x[i] = Sigmoid(x[i]);
+}
+
+inline bool HasAVX2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+#endif
+
+// x[i] = FastExp(x[i])
+inline void ExpArray(float *x, const int n) {
+#ifdef BOOSTED_TREE_X86_SIMD
+  if (HasAVX2()) {
+    ExpArrayAVX2(x, n);
+    return;
+  }
+#endif
+  for (int i = 0; i < n; ++i) x[i] = FastExp(x[i]);
+}
+
+// x[i] = Sigmoid(x[i])
+inline void SigmoidArray(float *x, const int n) {
+#ifdef BOOSTED_TREE_X86_SIMD
+  if (HasAVX2()) {
+    SigmoidArrayAVX2(x, n);
+    return;
+  }
+#endif
+  for (int i = 0; i < n; ++i) x[i] = Sigmoid(x[i]);
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef BOOSTED_TREE_GRADIENT_INFO_H_
+#define BOOSTED_TREE_GRADIENT_INFO_H_
+
+struct GradientInfo {
+  float gradient, hessian;
+  GradientInfo() : gradient(0), hessian(0){};
+  GradientInfo(float value) : gradient(value), hessian(value){};
+  GradientInfo(float g, float h) : gradient(g), hessian(h){};
+  GradientInfo &operator+=(const GradientInfo &b) {
+    gradient += b.gradient;
+    hessian += b.hessian;
+    return *this;
+  }
+  GradientInfo operator+(const GradientInfo &b) const {
+    GradientInfo info(gradient + b.gradient, hessian + b.hessian);
+    return info;
+  }
+  bool operator<(const GradientInfo &b) const { return hessian < b.hessian; }
+  operator float() const { return hessian; }
+};
+
+#endif
@@ -4,7 +4,11 @@
 #include <algorithm>
 #include <cmath>
 #include <numeric>
+#include <vector>
 
+#include "./fast_math.h"
+#include "./gradient_info.h"
+#include "./logging.h"
 #include "./registry.h"
 #include "./vec.h"
 
@@ -18,11 +22,47 @@ inline T clip(T value, T min_value, T max_value) {
 template <typename T>
 class Objective {
  public:
+  virtual ~Objective() = default;
   virtual T compute(T x, T y) = 0;
   virtual T gradient(T x, T y) = 0;
   virtual T hessian(T x, T y) = 0;
   virtual T predict(T x) = 0;
   virtual T estimate(const Vec<T> &Y) = 0;
+  /*
+   * the batch APIs, which are called per block of samples rather than per
+   * sample, the scalar APIs are called by default
+   */
+  virtual void gradient_hessian(const T *x, const T *y, GradientInfo *out,
+                                const int n) {
+    for (int i = 0; i < n; ++i) {
+      out[i] = GradientInfo(gradient(x[i], y[i]), hessian(x[i], y[i]));
+    }
+  }
+  // x = predict(x)
+  virtual void transform(T *x, const int n) {
+    for (int i = 0; i < n; ++i) x[i] = predict(x[i]);
+  }
+  /*
+   * the multi-class APIs, a sample has num_class adjacent margins in x and
+   * out, and y is the class id
+   */
+  virtual bool multiclass() const { return false; }
+  virtual T compute_multi(const T * /*x*/, T /*y*/, const int /*num_class*/) {
+    LOG(FATAL) << "Not a multi-class objective";
+    return 0;
+  }
+  virtual void gradient_hessian_multi(const T * /*x*/, const T * /*y*/,
+                                      GradientInfo * /*out*/, const int /*n*/,
+                                      const int /*num_class*/) {
+    LOG(FATAL) << "Not a multi-class objective";
+  }
+  // the outputs of a sample are the first num_outputs(num_class) values
+  virtual int num_outputs(const int /*num_class*/) const { return 1; }
+  // the outputs of the samples are written into x[0, n * num_outputs)
+  virtual void transform_multi(T * /*x*/, const int /*n*/,
+                               const int /*num_class*/) {
+    LOG(FATAL) << "Not a multi-class objective";
+  }
 };
 REGISTRY_ENABLE(Objective<float>);
 
@@ -46,6 +86,14 @@ class SquareLoss : public Objective<T> {
   }
   T predict(T x) { return x; }
   T estimate(const Vec<T> &Y) { return (T)Y.sum() / Y.size(); }
+  void gradient_hessian(const T *x, const T *y, GradientInfo *out,
+                        const int n) {
+    for (int i = 0; i < n; ++i) {
+      out[i].gradient = 2 * (x[i] - y[i]);
+      out[i].hessian = 2;
+    }
+  }
+  void transform(T * /*x*/, const int /*n*/) {}
 };
 
 template <typename T>
@@ -63,12 +111,123 @@ class LogisticLoss : public Objective<T> {
     const T pred = predict(x);
     return std::max(pred * (T(1) - pred), eps);
   }
-  T predict(T x) { return T(1) / (T(1) + exp(-x)); }
+  T predict(T x) { return Sigmoid(x); }
   T estimate(const Vec<T> &Y) {
     const T eps = 1e-16;
     T mean = std::max((T)Y.sum() / Y.size(), eps);
     return -log(std::max(T(1) / mean - T(1), eps));
   }
+  // one sigmoid per sample rather than one per gradient and hessian
+  void gradient_hessian(const T *x, const T *y, GradientInfo *out,
+                        const int n) {
+    constexpr int kBatch = 256;
+    const T eps = 1e-16;
+    T preds[kBatch];
+    for (int first = 0; first < n; first += kBatch) {
+      const int m = std::min(kBatch, n - first);
+      std::copy(x + first, x + first + m, preds);
+      SigmoidArray(preds, m);
+      for (int i = 0; i < m; ++i) {
+        out[first + i].gradient = preds[i] - y[first + i];
+        out[first + i].hessian = std::max(preds[i] * (T(1) - preds[i]), eps);
+      }
+    }
+  }
+  void transform(T *x, const int n) { SigmoidArray(x, n); }
+};
+
+/*
+ * softmax of num_class margins, the outputs are the class ids or the
+ * probabilities of the classes if output_prob
+ */
+template <typename T>
+class SoftmaxLoss : public Objective<T> {
+ public:
+  explicit SoftmaxLoss(const bool output_prob) : output_prob_(output_prob) {}
+  T compute(T /*x*/, T /*y*/) { return Unsupported(); }
+  T gradient(T /*x*/, T /*y*/) { return Unsupported(); }
+  T hessian(T /*x*/, T /*y*/) { return Unsupported(); }
+  T predict(T /*x*/) { return Unsupported(); }
+  T estimate(const Vec<T> & /*Y*/) { return Unsupported(); }
+  bool multiclass() const { return true; }
+  T compute_multi(const T *x, T y, const int num_class) {
+    // -log(softmax(x)[y])
+    const T max_x = *std::max_element(x, x + num_class);
+    double sum = 0;
+    for (int k = 0; k < num_class; ++k) sum += exp(double(x[k] - max_x));
+    return log(sum) - (x[int(y)] - max_x);
+  }
+  // the gradients of all the classes in one pass over the margins
+  void gradient_hessian_multi(const T *x, const T *y, GradientInfo *out,
+                              const int n, const int num_class) {
+    constexpr int kBatch = 1024;
+    const T eps = 1e-16;
+    // the probabilities of a batch of rows, one row at least
+    const int rows = std::max(1, kBatch / num_class);
+    static thread_local std::vector<T> buffer;
+    buffer.resize(size_t(rows) * num_class);
+    T *probs = buffer.data();
+    for (int first = 0; first < n; first += rows) {
+      const int m = std::min(rows, n - first);
+      const T *xs = x + size_t(first) * num_class;
+      ShiftByMax(xs, m, num_class, probs);
+      ExpArray(probs, m * num_class);
+      for (int i = 0; i < m; ++i) {
+        T *p = probs + i * num_class;
+        T sum = 0;
+        for (int k = 0; k < num_class; ++k) sum += p[k];
+        const int label = y[first + i];
+        GradientInfo *o = out + size_t(first + i) * num_class;
+        for (int k = 0; k < num_class; ++k) {
+          const T prob = p[k] / sum;
+          o[k].gradient = prob - T(k == label);
+          o[k].hessian = std::max(T(2) * prob * (T(1) - prob), eps);
+        }
+      }
+    }
+  }
+  int num_outputs(const int num_class) const {
+    return output_prob_ ? num_class : 1;
+  }
+  void transform_multi(T *x, const int n, const int num_class) {
+    if (!output_prob_) {
+      // the class ids, x[i] is written after the margins of row i are read
+      for (int i = 0; i < n; ++i) {
+        const T *row = x + size_t(i) * num_class;
+        x[i] = std::max_element(row, row + num_class) - row;
+      }
+      return;
+    }
+    for (int i = 0; i < n; ++i) {
+      T *row = x + size_t(i) * num_class;
+      const T max_x = *std::max_element(row, row + num_class);
+      for (int k = 0; k < num_class; ++k) row[k] -= max_x;
+      ExpArray(row, num_class);
+      T sum = 0;
+      for (int k = 0; k < num_class; ++k) sum += row[k];
+      for (int k = 0; k < num_class; ++k) row[k] /= sum;
+    }
+  }
+
+ private:
+  T Unsupported() {
+    LOG(FATAL) << "The softmax objectives only support the multi-class APIs";
+    return 0;
+  }
+  // out[i * num_class + k] = x[i * num_class + k] - max_k x[i * num_class + k]
+  static void ShiftByMax(const T *x, const int n, const int num_class,
+                         T *out) {
+    for (int i = 0; i < n; ++i) {
+      const T *row = x + i * num_class;
+      const T max_x = *std::max_element(row, row + num_class);
+      for (int k = 0; k < num_class; ++k) {
+        out[i * num_class + k] = row[k] - max_x;
+      }
+    }
+  }
+
+ private:
+  bool output_prob_;
 };
 
 class ObjectiveRegistry {
@@ -77,8 +236,13 @@ class ObjectiveRegistry {
     typedef float T;
     Registry<Objective<T>>::Register("reg:linear", new SquareLoss<T>());
     Registry<Objective<T>>::Register("binary:logistic", new LogisticLoss<T>());
+    Registry<Objective<T>>::Register("multi:softmax",
+                                     new SoftmaxLoss<T>(false));
+    Registry<Objective<T>>::Register("multi:softprob",
+                                     new SoftmaxLoss<T>(true));
   }
 };
-static ObjectiveRegistry registry_;
+// one instance for all the translation units
+inline ObjectiveRegistry registry_;
 
 #endif
@@ -43,9 +43,11 @@ std::vector<std::string> Registry<Entry>::List() {
   return names;
 }
 
-#define REGISTRY_ENABLE(Entry)              \
-  template <>                               \
-  Registry<Entry> &Registry<Entry>::Get() { \
-    static Registry<Entry> inst;            \
-    return inst;                            \
+// inline, so that the header defining the registry can be included by
+// multiple translation units, which share the instance
+#define REGISTRY_ENABLE(Entry)                     \
+  template <>                                      \
+  inline Registry<Entry> &Registry<Entry>::Get() { \
+    static Registry<Entry> inst;                   \
+    return inst;                                   \
   }
@@ -33,6 +33,9 @@ param = {'max_depth': 2, 'learning_rate': 1, 'objective': 'binary',
 num_round = 2
 bst = lgb.train(param, dtrain, num_round, valid_sets=[dtest])
 
+# load it by BoostedTree.load_lightgbm_model
+bst.save_model('lightgbm_model.txt')
+
 num_trees = bst.num_trees()
 print(f'Number of trees: {num_trees}')
 for i in range(num_trees):
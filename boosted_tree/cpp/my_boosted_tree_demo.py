@@ -39,7 +39,7 @@ model = bst.BoostedTree(param)
 train_X, train_Y = bst.ReadLibSVMFile(train_fname)
 test_X, test_Y = bst.ReadLibSVMFile(test_fname)
 
-model.train(train_X, train_Y)
+model.train(train_X, train_Y, eval_set=[(test_X, test_Y)])
 
 print(model)
 train_preds = model.predict(train_X)
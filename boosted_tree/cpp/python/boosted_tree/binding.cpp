@@ -3,6 +3,9 @@
 #include <boosted_tree/io.h>
 #include <boosted_tree/vec.h>
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <memory>
 
 namespace py = pybind11;
 
@@ -13,19 +16,63 @@ PYBIND11_MODULE(boosted_tree, m) {
       .def_readwrite("learning_rate", &BoostedTreeParam::learning_rate)
       .def_readwrite("n_estimators", &BoostedTreeParam::n_estimators)
       .def_readwrite("objective", &BoostedTreeParam::objective)
+      .def_readwrite("num_class", &BoostedTreeParam::num_class)
       .def_readwrite("reg_lambda", &BoostedTreeParam::reg_lambda)
       .def_readwrite("gamma", &BoostedTreeParam::gamma)
       .def_readwrite("n_jobs", &BoostedTreeParam::n_jobs)
       .def_readwrite("tree_method", &BoostedTreeParam::tree_method)
       .def_readwrite("sketch_eps", &BoostedTreeParam::sketch_eps)
+      .def_readwrite("max_bin", &BoostedTreeParam::max_bin)
+      .def_readwrite("max_cached_hist_node",
+                     &BoostedTreeParam::max_cached_hist_node)
+      .def_readwrite("enable_bundle", &BoostedTreeParam::enable_bundle)
+      .def_readwrite("max_conflict_rate",
+                     &BoostedTreeParam::max_conflict_rate)
       .def_readwrite("seed", &BoostedTreeParam::seed)
-      .def_readwrite("subsample", &BoostedTreeParam::subsample);
+      .def_readwrite("sampling_method", &BoostedTreeParam::sampling_method)
+      .def_readwrite("subsample", &BoostedTreeParam::subsample)
+      .def_readwrite("top_rate", &BoostedTreeParam::top_rate)
+      .def_readwrite("other_rate", &BoostedTreeParam::other_rate)
+      .def_readwrite("colsample_bytree", &BoostedTreeParam::colsample_bytree)
+      .def_readwrite("colsample_bylevel",
+                     &BoostedTreeParam::colsample_bylevel)
+      .def_readwrite("colsample_bynode", &BoostedTreeParam::colsample_bynode)
+      .def_readwrite("grow_policy", &BoostedTreeParam::grow_policy)
+      .def_readwrite("max_leaves", &BoostedTreeParam::max_leaves)
+      .def_readwrite("zero_as_missing", &BoostedTreeParam::zero_as_missing)
+      .def_readwrite("early_stopping_rounds",
+                     &BoostedTreeParam::early_stopping_rounds)
+      .def_readwrite("predictor", &BoostedTreeParam::predictor);
 
   py::class_<BoostedTree>(m, "BoostedTree")
       .def(py::init<const BoostedTreeParam &>())
-      .def("train", &BoostedTree::train)
-      .def("predict", &BoostedTree::predict)
-      .def("__str__", &BoostedTree::str);
+      .def("train", &BoostedTree::train, py::arg("X"), py::arg("Y"),
+           py::arg("eval_set") = std::vector<BoostedTree::EvalData>())
+      .def("predict", py::overload_cast<const CSRMatrix<float> &>(
+                          &BoostedTree::predict, py::const_))
+      .def("predict",
+           py::overload_cast<const CSRMatrix<float> &, const int, const int>(
+               &BoostedTree::predict, py::const_),
+           py::arg("X"), py::arg("tree_begin"), py::arg("tree_end"))
+      .def("num_outputs", &BoostedTree::num_outputs)
+      .def("predict_staged", &BoostedTree::predict_staged, py::arg("X"),
+           py::arg("tree_end") = -1)
+      .def("clear_margin_cache", &BoostedTree::clear_margin_cache)
+      .def("predict_label", &BoostedTree::predict_label, py::arg("X"),
+           py::arg("threshold"))
+      .def("export_cpp", &BoostedTree::export_cpp)
+      .def("save_model", &BoostedTree::save_model)
+      .def("load_model", &BoostedTree::load_model)
+      .def("load_xgboost_model", &BoostedTree::load_xgboost_model)
+      .def("load_lightgbm_model", &BoostedTree::load_lightgbm_model)
+      .def("__str__", &BoostedTree::str)
+      .def(py::pickle(
+          [](const BoostedTree &bst) { return py::bytes(bst.save_raw()); },
+          [](const py::bytes &state) {
+            auto bst = std::make_unique<BoostedTree>(BoostedTreeParam());
+            bst->load_raw(state);
+            return bst;
+          }));
 
   py::class_<CSRMatrix<float>>(m, "CSRMatrix").def(py::init<>());
 
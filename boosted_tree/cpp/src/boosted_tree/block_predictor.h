@@ -0,0 +1,189 @@
+#pragma once
+
+#include <boosted_tree/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BOOSTED_TREE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Block prediction: a block of dense rows goes through a tile of trees, and
+ * a group of Lanes() rows goes down a tree together with AVX2 / AVX-512
+ * gathers. The instruction set is detected at runtime unless the lanes are
+ * given, and Lanes() is 1 without SIMD.
+ *
+ * A node is viewed as 4 words {left, feature_id, value, flags}, the lowest
+ * byte of flags is is_leaf and the second byte is miss_left, the children of
+ * a node are adjacent.
+ */
+class BlockPredictor {
+ public:
+  static constexpr int kBlockRows = 64;
+  // the bytes of the dense rows of a block
+  static constexpr size_t kMaxBlockBytes = 1 << 20;
+  // the nodes of a tile of trees, 64KB
+  static constexpr int kTileNodes = 4096;
+
+ public:
+  // lanes: 16 (AVX-512), 8 (AVX2), 1 (scalar), or 0 for the widest supported
+  explicit BlockPredictor(const int lanes = 0) : lanes_(lanes) {
+    if (lanes_ == 0) lanes_ = Supports(16) ? 16 : Supports(8) ? 8 : 1;
+    CHECK(Supports(lanes_)) << "Not supported lanes " << lanes_;
+  }
+
+  static bool Supports(const int lanes) {
+    if (lanes == 1) return true;
+#ifdef BOOSTED_TREE_X86_SIMD
+    if (lanes == 16) return __builtin_cpu_supports("avx512f");
+    if (lanes == 8) return __builtin_cpu_supports("avx2");
+#endif
+    return false;
+  }
+
+  inline int Lanes() const { return lanes_; }
+
+  // the rows of a block, the wide rows are fewer to stay in kMaxBlockBytes
+  static int BlockRows(const int num_features) {
+    const size_t row_bytes = std::max(num_features, 1) * sizeof(float);
+    return std::max<int>(
+        1, std::min<size_t>(kBlockRows, kMaxBlockBytes / row_bytes));
+  }
+
+  /*
+   * out[i] += the predictions of the trees roots[0, num_trees) for the row
+   * x + i * stride, i in [0, Lanes()), the values are added in tree order
+   */
+  void Traverse(const int32_t *nodes, const int *roots, const int num_trees,
+                const float *x, const int stride, const bool zero_as_missing,
+                float *out) const {
+#ifdef BOOSTED_TREE_X86_SIMD
+    if (lanes_ == 16) {
+      TraverseAVX512(nodes, roots, num_trees, x, stride, zero_as_missing, out);
+      return;
+    } else if (lanes_ == 8) {
+      TraverseAVX2(nodes, roots, num_trees, x, stride, zero_as_missing, out);
+      return;
+    }
+#endif
+    TraverseScalar(nodes, roots, num_trees, x, zero_as_missing, out);
+  }
+
+ private:
+  static void TraverseScalar(const int32_t *nodes, const int *roots,
+                             const int num_trees, const float *x,
+                             const bool zero_as_missing, float *out) {
+    const float *values = reinterpret_cast<const float *>(nodes + 2);
+    for (int t = 0; t < num_trees; ++t) {
+      int idx = roots[t];
+      while (1) {
+        const int32_t *node = nodes + idx * 4;
+        const uint8_t *flags = reinterpret_cast<const uint8_t *>(node + 3);
+        if (flags[0]) break;
+        const float v = x[node[1]];
+        const bool missing = std::isnan(v) || (zero_as_missing && v == 0);
+        const bool is_left = missing ? flags[1] : v < values[idx * 4];
+        idx = node[0] + !is_left;
+      }
+      *out += values[idx * 4];
+    }
+  }
+
+#ifdef BOOSTED_TREE_X86_SIMD
+  __attribute__((target("avx2"))) static void TraverseAVX2(
+      const int32_t *nodes, const int *roots, const int num_trees,
+      const float *x, const int stride, const bool zero_as_missing,
+      float *out) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i leaf_byte = _mm256_set1_epi32(0xff);
+    const __m256i miss_byte = _mm256_set1_epi32(0xff00);
+    const __m256i zero_i = _mm256_setzero_si256();
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 zero_missing =
+        _mm256_castsi256_ps(_mm256_set1_epi32(zero_as_missing ? -1 : 0));
+    const __m256i rows = _mm256_mullo_epi32(
+        _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    const float *values = reinterpret_cast<const float *>(nodes + 2);
+    __m256 acc = _mm256_loadu_ps(out);
+    for (int t = 0; t < num_trees; ++t) {
+      __m256i idx = _mm256_set1_epi32(roots[t]);
+      // the word offset of a node is idx * 4, gathered as (idx * 2) * 8 bytes
+      __m256i off = _mm256_add_epi32(idx, idx);
+      while (1) {
+        const __m256i flags = _mm256_i32gather_epi32(nodes + 3, off, 8);
+        const __m256i inner =
+            _mm256_cmpeq_epi32(_mm256_and_si256(flags, leaf_byte), zero_i);
+        if (_mm256_testz_si256(inner, inner)) break;
+        const __m256i left = _mm256_i32gather_epi32(nodes, off, 8);
+        const __m256i feature = _mm256_i32gather_epi32(nodes + 1, off, 8);
+        const __m256 value = _mm256_i32gather_ps(values, off, 8);
+        const __m256 v =
+            _mm256_mask_i32gather_ps(zero, x, _mm256_add_epi32(rows, feature),
+                                     _mm256_castsi256_ps(inner), 4);
+        const __m256 missing = _mm256_or_ps(
+            _mm256_cmp_ps(v, v, _CMP_UNORD_Q),
+            _mm256_and_ps(zero_missing, _mm256_cmp_ps(v, zero, _CMP_EQ_OQ)));
+        const __m256 miss_right = _mm256_castsi256_ps(
+            _mm256_cmpeq_epi32(_mm256_and_si256(flags, miss_byte), zero_i));
+        const __m256 go_right = _mm256_blendv_ps(
+            _mm256_cmp_ps(v, value, _CMP_NLT_UQ), miss_right, missing);
+        const __m256i next = _mm256_add_epi32(
+            left, _mm256_and_si256(_mm256_castps_si256(go_right), one));
+        idx = _mm256_blendv_epi8(idx, next, inner);
+        off = _mm256_add_epi32(idx, idx);
+      }
+      acc = _mm256_add_ps(acc, _mm256_i32gather_ps(values, off, 8));
+    }
+    _mm256_storeu_ps(out, acc);
+  }
+
+  __attribute__((target("avx512f"))) static void TraverseAVX512(
+      const int32_t *nodes, const int *roots, const int num_trees,
+      const float *x, const int stride, const bool zero_as_missing,
+      float *out) {
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i leaf_byte = _mm512_set1_epi32(0xff);
+    const __m512i miss_byte = _mm512_set1_epi32(0xff00);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512i rows = _mm512_mullo_epi32(
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                          15),
+        _mm512_set1_epi32(stride));
+    const float *values = reinterpret_cast<const float *>(nodes + 2);
+    __m512 acc = _mm512_loadu_ps(out);
+    for (int t = 0; t < num_trees; ++t) {
+      __m512i idx = _mm512_set1_epi32(roots[t]);
+      __m512i off = _mm512_add_epi32(idx, idx);
+      while (1) {
+        const __m512i flags = _mm512_i32gather_epi32(off, nodes + 3, 8);
+        const __mmask16 inner = _mm512_testn_epi32_mask(flags, leaf_byte);
+        if (inner == 0) break;
+        const __m512i left = _mm512_i32gather_epi32(off, nodes, 8);
+        const __m512i feature = _mm512_i32gather_epi32(off, nodes + 1, 8);
+        const __m512 value = _mm512_i32gather_ps(off, values, 8);
+        const __m512 v = _mm512_mask_i32gather_ps(
+            zero, inner, _mm512_add_epi32(rows, feature), x, 4);
+        __mmask16 missing = _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q);
+        if (zero_as_missing) missing |= _mm512_cmp_ps_mask(v, zero, _CMP_EQ_OQ);
+        const __mmask16 miss_right = _mm512_testn_epi32_mask(flags, miss_byte);
+        const __mmask16 go_right =
+            (missing & miss_right) |
+            (~missing & _mm512_cmp_ps_mask(v, value, _CMP_NLT_UQ));
+        const __m512i next = _mm512_mask_add_epi32(left, go_right, left, one);
+        idx = _mm512_mask_mov_epi32(idx, inner, next);
+        off = _mm512_add_epi32(idx, idx);
+      }
+      acc = _mm512_add_ps(acc, _mm512_i32gather_ps(off, values, 8));
+    }
+    _mm512_storeu_ps(out, acc);
+  }
+#endif
+
+ private:
+  int lanes_;
+};
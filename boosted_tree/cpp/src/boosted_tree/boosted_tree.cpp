@@ -3,10 +3,18 @@
 #include <boosted_tree/quantile.h>
 #include <omp.h>
 
+#include <algorithm>
 #include <cfloat>
+#include <cmath>
+#include <cstddef>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <numeric>
 #include <set>
 #include <stack>
@@ -20,16 +28,101 @@ BoostedTree::BoostedTree(const BoostedTreeParam &param)
 
 BoostedTree::~BoostedTree() = default;
 
-void BoostedTree::train(const CSRMatrix<float> &X, const Vec<float> &Y) {
-  pImpl->train(X, Y);
+void BoostedTree::train(const CSRMatrix<float> &X, const Vec<float> &Y,
+                        const std::vector<EvalData> &eval_set) {
+  pImpl->train(X, Y, eval_set);
 }
 
 Vec<float> BoostedTree::predict(const CSRMatrix<float> &X) const {
   return pImpl->predict(X);
 }
 
+int BoostedTree::num_outputs() const { return pImpl->num_outputs(); }
+
+Vec<float> BoostedTree::predict(const CSRMatrix<float> &X,
+                                const int tree_begin,
+                                const int tree_end) const {
+  return pImpl->predict(X, tree_begin, tree_end);
+}
+
+Vec<float> BoostedTree::predict_staged(const CSRMatrix<float> &X,
+                                       const int tree_end) {
+  return pImpl->predict_staged(X, tree_end);
+}
+
+void BoostedTree::clear_margin_cache() { pImpl->clear_margin_cache(); }
+
+Vec<float> BoostedTree::predict_label(const CSRMatrix<float> &X,
+                                      const float threshold) const {
+  return pImpl->predict_label(X, threshold);
+}
+
 std::string BoostedTree::str() const { return pImpl->str(); }
 
+std::string BoostedTree::export_cpp() const { return pImpl->export_cpp(); }
+
+void BoostedTree::save_model(const std::string &fname) const {
+  pImpl->save_model(fname);
+}
+
+void BoostedTree::load_model(const std::string &fname) {
+  pImpl->load_model(fname);
+}
+
+std::string BoostedTree::save_raw() const { return pImpl->save_raw(); }
+
+void BoostedTree::load_raw(const std::string &buf) { pImpl->load_raw(buf); }
+
+void BoostedTree::load_xgboost_model(const std::string &fname) {
+  pImpl->load_xgboost_model(fname);
+}
+
+void BoostedTree::load_lightgbm_model(const std::string &fname) {
+  pImpl->load_lightgbm_model(fname);
+}
+
+namespace {
+std::string ReadFile(const std::string &fname) {
+  std::ifstream fin(fname, std::ios::binary);
+  CHECK(fin.is_open()) << "Open file " << fname << " fail!";
+  std::stringstream ss;
+  ss << fin.rdbuf();
+  return ss.str();
+}
+
+// visit the params stored in the model files
+template <typename Param, typename Visitor>
+void VisitParams(Param &param, Visitor visit) {
+  visit("max_depth", param.max_depth);
+  visit("learning_rate", param.learning_rate);
+  visit("n_estimators", param.n_estimators);
+  visit("objective", param.objective);
+  visit("num_class", param.num_class);
+  visit("reg_lambda", param.reg_lambda);
+  visit("gamma", param.gamma);
+  visit("n_jobs", param.n_jobs);
+  visit("seed", param.seed);
+  visit("tree_method", param.tree_method);
+  visit("sketch_eps", param.sketch_eps);
+  visit("max_bin", param.max_bin);
+  visit("max_cached_hist_node", param.max_cached_hist_node);
+  visit("enable_bundle", param.enable_bundle);
+  visit("max_conflict_rate", param.max_conflict_rate);
+  visit("sampling_method", param.sampling_method);
+  visit("subsample", param.subsample);
+  visit("top_rate", param.top_rate);
+  visit("other_rate", param.other_rate);
+  visit("colsample_bytree", param.colsample_bytree);
+  visit("colsample_bylevel", param.colsample_bylevel);
+  visit("colsample_bynode", param.colsample_bynode);
+  visit("grow_policy", param.grow_policy);
+  visit("max_leaves", param.max_leaves);
+  visit("zero_as_missing", param.zero_as_missing);
+  visit("early_stopping_rounds", param.early_stopping_rounds);
+  visit("predictor", param.predictor);
+}
+}  // namespace
+
 BoostedTree::Impl::Impl(const BoostedTreeParam &param) : param_(param) {
   objective = Registry<Objective<float>>::Find(param_.objective);
   if (objective == nullptr) {
@@ -47,70 +140,524 @@ BoostedTree::Impl::Impl(const BoostedTreeParam &param) : param_(param) {
     }
     LOG(FATAL) << msg;
   }
-  std::set<std::string> tree_methods{"auto", "exact", "approx"};
+  std::set<std::string> tree_methods{"auto", "exact", "approx", "hist"};
   CHECK(tree_methods.count(param_.tree_method))
       << "Not supported " << param_.tree_method
-      << ", tree_method should be in [\"auto\", \"exact\", \"approx\"]";
-  CHECK(param_.subsample >= 0 && param_.subsample <= 1)
-      << "subsample should be in [0, 1]";
+      << ", tree_method should be in [\"auto\", \"exact\", \"approx\", "
+         "\"hist\"]";
+  CHECK(param_.subsample > 0 && param_.subsample <= 1)
+      << "subsample should be in (0, 1]";
+  CHECK(param_.sampling_method == "uniform" || param_.sampling_method == "goss")
+      << "Not supported " << param_.sampling_method
+      << ", sampling_method should be in [\"uniform\", \"goss\"]";
+  if (param_.sampling_method == "goss") {
+    CHECK(param_.top_rate > 0 && param_.other_rate > 0 &&
+          param_.top_rate + param_.other_rate <= 1)
+        << "top_rate and other_rate should be positive, and "
+           "top_rate + other_rate <= 1";
+  }
+  CHECK(param_.max_bin >= 2 && param_.max_bin <= 65534)
+      << "max_bin should be in [2, 65534]";
+  CHECK(param_.grow_policy == "depthwise" || param_.grow_policy == "lossguide")
+      << "Not supported " << param_.grow_policy
+      << ", grow_policy should be in [\"depthwise\", \"lossguide\"]";
+  CHECK_GE(param_.max_leaves, 0);
+  CHECK(param_.max_conflict_rate >= 0 && param_.max_conflict_rate < 1)
+      << "max_conflict_rate should be in [0, 1)";
+  CHECK(param_.colsample_bytree > 0 && param_.colsample_bytree <= 1)
+      << "colsample_bytree should be in (0, 1]";
+  CHECK(param_.colsample_bylevel > 0 && param_.colsample_bylevel <= 1)
+      << "colsample_bylevel should be in (0, 1]";
+  CHECK(param_.colsample_bynode > 0 && param_.colsample_bynode <= 1)
+      << "colsample_bynode should be in (0, 1]";
+  if (objective->multiclass()) {
+    CHECK_GE(param_.num_class, 2) << " num_class is needed by "
+                                   << param_.objective;
+  } else {
+    CHECK_EQ(param_.num_class, 1) << " num_class is only for multi:softmax "
+                                     "and multi:softprob";
+  }
+  CHECK_GE(param_.early_stopping_rounds, 0);
+  CHECK(param_.predictor == "traversal" || param_.predictor == "quickscorer" ||
+        param_.predictor == "block" || param_.predictor == "compact")
+      << "Not supported " << param_.predictor
+      << ", predictor should be in [\"traversal\", \"quickscorer\", "
+         "\"block\", \"compact\"]";
 }
 
-void BoostedTree::Impl::train(const CSRMatrix<float> &X, const Vec<float> &Y) {
-  srand(param_.seed);
+void BoostedTree::Impl::train(const CSRMatrix<float> &X, const Vec<float> &Y,
+                              const std::vector<EvalData> &eval_set) {
+  rng_.seed(param_.seed);
+  if (mapped_file_) {
+    // the trees of a loaded model are extended in memory
+    nodes_.assign(mapped_nodes_, mapped_nodes_ + num_mapped_nodes_);
+    mapped_file_.reset();
+  }
   const int num_samples = X.length();
   const int num_features = X[0].length();
   CHECK_EQ(num_samples, Y.size());
   LOG(INFO) << "Input Data: (" << num_samples << " X " << num_features << ")";
+  // the margins of every class, a round builds a tree per class, and the
+  // new trees are fitted to the residuals of the existing ones
+  std::vector<Vec<float>> integrals = InitMargins(X);
+  const int num_eval_sets = eval_set.size();
+  std::vector<std::vector<Vec<float>>> eval_integrals(num_eval_sets);
+  for (int e = 0; e < num_eval_sets; ++e) {
+    CHECK_EQ(eval_set[e].first.length(), eval_set[e].second.size());
+    eval_integrals[e] = InitMargins(eval_set[e].first);
+  }
+  // the existing trees may use more features
+  num_features_ = trees.empty() ? num_features
+                                : std::max(num_features_, num_features);
   XT_ = X.transpose();
   Y_ = std::move(Y);
+  if (param_.tree_method == "hist") {
+    BuildBinMatrix();
+    hist_pool_.Reset(bins_.NumBins(), param_.max_cached_hist_node);
+  }
+  if (param_.tree_method == "exact") {
+    columns_.Reset(XT_, param_.zero_as_missing, param_.n_jobs);
+  }
+  positions_.assign(num_samples, -1);
+  go_left_.assign(num_samples, 0);
   LOG(INFO) << "Start training...";
-  std::vector<int> sample_ids(num_samples);
-  std::iota(sample_ids.begin(), sample_ids.end(), 0);
   std::vector<int> feature_ids(num_features);
   std::iota(feature_ids.begin(), feature_ids.end(), 0);
-  Vec<float> integrals(num_samples);
-  integrals = 0;
-  for (int iter = 1; iter <= param_.n_estimators; ++iter) {
-    int root = CreateNode(integrals, sample_ids, feature_ids, 1);
-    trees.push_back(root);
-    Vec<float> pred = predict(X);
-    float loss = 0;
+  const int num_class = param_.num_class;
+  if (num_class > 1) {
     for (int i = 0; i < num_samples; ++i) {
-      loss += objective->compute(pred[i], Y_[i]);
+      CHECK(Y_[i] >= 0 && Y_[i] < num_class && Y_[i] == int(Y_[i]))
+          << "The label " << Y_[i] << " should be a class id in [0, "
+          << num_class << ")";
     }
-    loss /= num_samples;
-    LOG(INFO) << "Iteration: " << iter << " Loss: " << loss;
+  }
+  gpair_.resize(num_samples);
+  row_sampled_.assign(num_samples, 1);
+  const bool early_stopping =
+      param_.early_stopping_rounds > 0 && num_eval_sets > 0;
+  // the trees before this call are kept by early stopping
+  const int trees_at_entry = trees.size();
+  float best_eval_loss = FLT_MAX;
+  int best_iter = 0;
+  for (int iter = 1; iter <= param_.n_estimators; ++iter) {
+    ComputeGradients(integrals);
+    const int first_tree = trees.size();
+    for (int k = 0; k < num_class; ++k) {
+      if (num_class > 1) SelectClassGradients(k);
+      const int num_sampled_rows = SampleRows(iter);
+      int root = AllocNodes(1);
+      BuildTree(root, integrals[k], num_sampled_rows, feature_ids);
+      trees.push_back(root);
+      if (num_sampled_rows < num_samples) {
+        // the margins of the sampled rows are updated by their leaves
+        Vec<float> &class_integrals = integrals[k];
+#pragma omp parallel for num_threads(param_.n_jobs)
+        for (int i = 0; i < num_samples; ++i) {
+          if (!row_sampled_[i]) {
+            class_integrals[i] += predict_one_in_a_tree(X[i], root);
+          }
+        }
+      }
+    }
+    // integrals are the margins of the training samples
+    float loss = ComputeLoss(integrals, Y_);
+    std::stringstream ss;
+    ss << "Iteration: " << iter << " Loss: " << loss;
+    float eval_loss = 0;
+    for (int e = 0; e < num_eval_sets; ++e) {
+      const CSRMatrix<float> &eval_X = eval_set[e].first;
+      for (int k = 0; k < num_class; ++k) {
+        Vec<float> &eval_integral = eval_integrals[e][k];
+        const int root = trees[first_tree + k];
+        const int N = eval_integral.size();
+#pragma omp parallel for num_threads(param_.n_jobs)
+        for (int i = 0; i < N; ++i) {
+          eval_integral[i] += predict_one_in_a_tree(eval_X[i], root);
+        }
+      }
+      eval_loss = ComputeLoss(eval_integrals[e], eval_set[e].second);
+      ss << " Eval" << e << " Loss: " << eval_loss;
+    }
+    LOG(INFO) << ss.str();
     if (loss <= 1e-3) break;
+    if (early_stopping) {
+      // the last evaluation set is used for early stopping, a NaN loss is
+      // replaced by any later loss and never replaces a number
+      if (best_iter == 0 || eval_loss < best_eval_loss ||
+          std::isnan(best_eval_loss)) {
+        best_eval_loss = eval_loss;
+        best_iter = iter;
+      } else if (iter - best_iter >= param_.early_stopping_rounds) {
+        LOG(INFO) << "Early stopping, best iteration: " << best_iter
+                  << " Eval Loss: " << best_eval_loss;
+        // the nodes of the trees after the best iteration are at the end
+        const int num_trees = trees_at_entry + best_iter * num_class;
+        nodes_.resize(trees[num_trees]);
+        trees.resize(num_trees);
+        break;
+      }
+    }
+  }
+  BuildPredictor();
+}
+
+std::vector<Vec<float>> BoostedTree::Impl::InitMargins(
+    const CSRMatrix<float> &X) const {
+  const int N = X.length();
+  const int num_class = param_.num_class;
+  std::vector<Vec<float>> margins(num_class, Vec<float>(base_margin_, N));
+  if (trees.empty() || N == 0) return margins;
+  Vec<float> packed(base_margin_, size_t(N) * num_class);
+  AddTreeMargins(X, 0, trees.size(), &packed[0]);
+  for (int i = 0; i < N; ++i) {
+    for (int k = 0; k < num_class; ++k) {
+      margins[k][i] = packed[size_t(i) * num_class + k];
+    }
+  }
+  return margins;
+}
+
+float BoostedTree::Impl::ComputeLoss(const std::vector<Vec<float>> &integrals,
+                                     const Vec<float> &Y) const {
+  const int N = Y.size();
+  if (N == 0) return 0;
+  const int num_class = integrals.size();
+  double loss = 0;
+  if (num_class == 1) {
+    for (int i = 0; i < N; ++i) {
+      loss += objective->compute(integrals[0][i], Y[i]);
+    }
+    return loss / N;
+  }
+  std::vector<float> margins(num_class);
+  for (int i = 0; i < N; ++i) {
+    for (int k = 0; k < num_class; ++k) margins[k] = integrals[k][i];
+    loss += objective->compute_multi(margins.data(), Y[i], num_class);
   }
+  return loss / N;
 }
 
 Vec<float> BoostedTree::Impl::predict(const CSRMatrix<float> &X) const {
+  if (param_.predictor == "block") return Transform(PredictBlocks(X));
   const int N = X.length();
-  Vec<float> preds(N);
+  const int num_class = param_.num_class;
+  Vec<float> margins(size_t(N) * num_class);
 #pragma omp parallel for num_threads(param_.n_jobs)
   for (int i = 0; i < N; ++i) {
     CSRRow<float> x = X[i];
-    preds[i] = predict_one(x);
+    PredictMargins(x, &margins[size_t(i) * num_class]);
+  }
+  return Transform(std::move(margins));
+}
+
+Vec<float> BoostedTree::Impl::predict(const CSRMatrix<float> &X,
+                                      const int tree_begin,
+                                      const int tree_end) const {
+  CHECK(0 <= tree_begin && tree_begin <= tree_end &&
+        tree_end <= static_cast<int>(trees.size()))
+      << "Bad tree range [" << tree_begin << ", " << tree_end << ")";
+  const int N = X.length();
+  Vec<float> margins(base_margin_, size_t(N) * param_.num_class);
+  if (N == 0) return margins;
+  AddTreeMargins(X, tree_begin, tree_end, &margins[0]);
+  return Transform(std::move(margins));
+}
+
+Vec<float> BoostedTree::Impl::predict_staged(const CSRMatrix<float> &X,
+                                             int tree_end) {
+  if (tree_end < 0) tree_end = trees.size();
+  CHECK_LE(tree_end, static_cast<int>(trees.size()));
+  const size_t num_margins = size_t(X.length()) * param_.num_class;
+  // drop the caches of the freed matrices
+  for (auto it = margin_caches_.begin(); it != margin_caches_.end();) {
+    it = it->first.expired() ? margin_caches_.erase(it) : std::next(it);
+  }
+  MarginCache &cache = margin_caches_[X.storage()];
+  // the sums of floats can't be reverted, so a shorter prefix is recomputed
+  if (cache.margins.size() != num_margins || cache.nnz != X.nnz() ||
+      cache.num_trees > tree_end) {
+    cache.margins = Vec<float>(base_margin_, num_margins);
+    cache.nnz = X.nnz();
+    cache.num_trees = 0;
+  }
+  if (num_margins == 0) return Vec<float>();
+  AddTreeMargins(X, cache.num_trees, tree_end, &cache.margins[0]);
+  cache.num_trees = tree_end;
+  return Transform(cache.margins);
+}
+
+void BoostedTree::Impl::clear_margin_cache() { margin_caches_.clear(); }
+
+Vec<float> BoostedTree::Impl::predict_label(const CSRMatrix<float> &X,
+                                            const float threshold) const {
+  CHECK_EQ(param_.num_class, 1) << " predict_label is for a margin per row";
+  const int num_trees = trees.size();
+  // the bounds of the values which the trees [t, num_trees) can add, the
+  // bounds are widened by the rounding errors of the float sums
+  std::vector<double> rest_min(num_trees + 1, 0), rest_max(num_trees + 1, 0),
+      rest_abs(num_trees + 1, 0);
+  for (int t = num_trees - 1; t >= 0; --t) {
+    rest_min[t] = rest_min[t + 1] + leaf_ranges_[t].first;
+    rest_max[t] = rest_max[t + 1] + leaf_ranges_[t].second;
+    rest_abs[t] = rest_abs[t + 1] + std::max(std::abs(leaf_ranges_[t].first),
+                                             std::abs(leaf_ranges_[t].second));
+  }
+  // the decision is checked every kCheckTrees trees
+  constexpr int kCheckTrees = 8;
+  const int N = X.length();
+  Vec<float> labels(N);
+#pragma omp parallel for num_threads(param_.n_jobs)
+  for (int i = 0; i < N; ++i) {
+    static thread_local std::vector<float> dense;
+    if (dense.size() < size_t(num_features_)) dense.resize(num_features_, 0);
+    const CSRRow<float> row = X[i];
+    const dim_t *indices = row.indices();
+    const float *values = row.values();
+    for (dim_t k = 0; k < row.nnz(); ++k) {
+      if (indices[k] < num_features_) dense[indices[k]] = values[k];
+    }
+    float out = base_margin_;
+    int label = -1;
+    for (int t = 0; t < num_trees; ++t) {
+      out += predict_one_in_a_tree(dense.data(), trees[t]);
+      if ((t + 1) % kCheckTrees != 0 || t + 1 == num_trees) continue;
+      const double err =
+          (num_trees + 1) * FLT_EPSILON * (std::abs(out) + rest_abs[t + 1]);
+      if (objective->predict(out + rest_min[t + 1] - err) >= threshold) {
+        label = 1;
+        break;
+      }
+      if (objective->predict(out + rest_max[t + 1] + err) < threshold) {
+        label = 0;
+        break;
+      }
+    }
+    if (label < 0) label = objective->predict(out) >= threshold;
+    labels[i] = label;
+    for (dim_t k = 0; k < row.nnz(); ++k) {
+      if (indices[k] < num_features_) dense[indices[k]] = 0;
+    }
+  }
+  return labels;
+}
+
+void BoostedTree::Impl::AddTreeMargins(const CSRMatrix<float> &X,
+                                       const int tree_begin,
+                                       const int tree_end,
+                                       float *margins) const {
+  if (tree_begin == tree_end) return;
+  const int N = X.length();
+  const int num_class = param_.num_class;
+#pragma omp parallel for num_threads(param_.n_jobs)
+  for (int i = 0; i < N; ++i) {
+    static thread_local std::vector<float> dense;
+    if (dense.size() < size_t(num_features_)) dense.resize(num_features_, 0);
+    const CSRRow<float> row = X[i];
+    const dim_t *indices = row.indices();
+    const float *values = row.values();
+    for (dim_t k = 0; k < row.nnz(); ++k) {
+      if (indices[k] < num_features_) dense[indices[k]] = values[k];
+    }
+    // the values are added in the order of the trees as predict does
+    float *out = margins + size_t(i) * num_class;
+    for (int t = tree_begin; t < tree_end; ++t) {
+      out[t % num_class] += predict_one_in_a_tree(dense.data(), trees[t]);
+    }
+    for (dim_t k = 0; k < row.nnz(); ++k) {
+      if (indices[k] < num_features_) dense[indices[k]] = 0;
+    }
   }
-  return preds;
+}
+
+Vec<float> BoostedTree::Impl::PredictBlocks(const CSRMatrix<float> &X) const {
+  static_assert(offsetof(Node, left) == 0 &&
+                    offsetof(Node, feature_id) == 4 &&
+                    offsetof(Node, value) == 8 &&
+                    offsetof(Node, is_leaf) == 12 &&
+                    offsetof(Node, miss_left) == 13,
+                "BlockPredictor depends on the layout of Node");
+  constexpr int kBlockRows = BlockPredictor::kBlockRows;
+  const int block_rows = BlockPredictor::BlockRows(num_features_);
+  const BlockPredictor predictor;
+  const int lanes = predictor.Lanes();
+  const int num_trees = trees.size();
+  const int num_class = param_.num_class;
+  // the roots of every class, the tree t is of the class t % num_class
+  std::vector<std::vector<int>> roots(num_class);
+  for (int t = 0; t < num_trees; ++t) roots[t % num_class].push_back(trees[t]);
+  // split the trees of a class into the tiles [tiles[k], tiles[k + 1])
+  std::vector<std::vector<int>> tiles(num_class);
+  for (int c = 0; c < num_class; ++c) {
+    tiles[c].push_back(0);
+    int tile_nodes = 0;
+    for (int j = 0; j < static_cast<int>(roots[c].size()); ++j) {
+      const int t = j * num_class + c;
+      const int end =
+          t + 1 < num_trees ? trees[t + 1] : static_cast<int>(NumModelNodes());
+      if (tile_nodes > 0 &&
+          tile_nodes + end - trees[t] > BlockPredictor::kTileNodes) {
+        tiles[c].push_back(j);
+        tile_nodes = 0;
+      }
+      tile_nodes += end - trees[t];
+    }
+    tiles[c].push_back(roots[c].size());
+  }
+  const int N = X.length();
+  const int num_blocks = (N + block_rows - 1) / block_rows;
+  const int32_t *nodes = reinterpret_cast<const int32_t *>(ModelNodes());
+  Vec<float> margins(size_t(N) * num_class);
+#pragma omp parallel for num_threads(param_.n_jobs)
+  for (int b = 0; b < num_blocks; ++b) {
+    const int first = b * block_rows;
+    const int num_rows = std::min(N - first, block_rows);
+    // the dense rows of the block, only the stored entries are reset
+    static thread_local std::vector<float> dense;
+    if (dense.size() < size_t(block_rows) * num_features_) {
+      dense.resize(size_t(block_rows) * num_features_, 0);
+    }
+    for (int r = 0; r < num_rows; ++r) {
+      const CSRRow<float> row = X[first + r];
+      const dim_t *indices = row.indices();
+      const float *values = row.values();
+      float *x = dense.data() + size_t(r) * num_features_;
+      for (dim_t k = 0; k < row.nnz(); ++k) {
+        if (indices[k] < num_features_) x[indices[k]] = values[k];
+      }
+    }
+    for (int c = 0; c < num_class; ++c) {
+      const std::vector<int> &class_roots = roots[c];
+      const std::vector<int> &class_tiles = tiles[c];
+      float out[kBlockRows];
+      std::fill(out, out + kBlockRows, base_margin_);
+      for (size_t k = 0; k + 1 < class_tiles.size(); ++k) {
+        int r = 0;
+        for (; r + lanes <= num_rows; r += lanes) {
+          predictor.Traverse(nodes, class_roots.data() + class_tiles[k],
+                             class_tiles[k + 1] - class_tiles[k],
+                             dense.data() + size_t(r) * num_features_,
+                             num_features_, param_.zero_as_missing, out + r);
+        }
+        // the rest rows
+        for (; r < num_rows; ++r) {
+          const float *x = dense.data() + size_t(r) * num_features_;
+          for (int j = class_tiles[k]; j < class_tiles[k + 1]; ++j) {
+            out[r] += predict_one_in_a_tree(x, class_roots[j]);
+          }
+        }
+      }
+      for (int r = 0; r < num_rows; ++r) {
+        margins[size_t(first + r) * num_class + c] = out[r];
+      }
+    }
+    for (int r = 0; r < num_rows; ++r) {
+      const CSRRow<float> row = X[first + r];
+      const dim_t *indices = row.indices();
+      float *x = dense.data() + size_t(r) * num_features_;
+      for (dim_t k = 0; k < row.nnz(); ++k) {
+        if (indices[k] < num_features_) x[indices[k]] = 0;
+      }
+    }
+  }
+  return margins;
+}
+
+int BoostedTree::Impl::num_outputs() const {
+  return objective->num_outputs(param_.num_class);
+}
+
+Vec<float> BoostedTree::Impl::Transform(Vec<float> margins) const {
+  const int num_class = param_.num_class;
+  const int N = margins.size() / num_class;
+  if (N == 0) return margins;
+  if (num_class == 1) {
+    objective->transform(&margins[0], N);
+    return margins;
+  }
+  objective->transform_multi(&margins[0], N, num_class);
+  const int num_outputs = objective->num_outputs(num_class);
+  if (num_outputs == num_class) return margins;
+  return Vec<float>(&margins[0], &margins[0] + size_t(N) * num_outputs);
 }
 
 float BoostedTree::Impl::predict_one(const CSRRow<float> &X) const {
-  float out = 0;
-  for (int root : trees) {
-    out += predict_one_in_a_tree(X, root);
+  CHECK_EQ(param_.num_class, 1) << " predict_one is for a margin per row";
+  float margin;
+  PredictMargins(X, &margin);
+  return objective->predict(margin);
+}
+
+void BoostedTree::Impl::PredictMargins(const CSRRow<float> &X,
+                                       float *out) const {
+  // scatter the row into a dense buffer once rather than searching the row
+  // at every node, only the stored entries are reset after the traversal
+  static thread_local std::vector<float> dense;
+  if (dense.size() < size_t(num_features_)) dense.resize(num_features_, 0);
+  const dim_t nnz = X.nnz();
+  const dim_t *indices = X.indices();
+  const float *values = X.values();
+  for (dim_t k = 0; k < nnz; ++k) {
+    if (indices[k] < num_features_) dense[indices[k]] = values[k];
+  }
+  const int num_class = param_.num_class;
+  std::fill(out, out + num_class, base_margin_);
+  if (param_.predictor == "quickscorer") {
+    // the values are added in the order of the trees as the traversal does
+    static thread_local std::vector<float> values;
+    values.resize(trees.size());
+    quick_scorer_.Predict(
+        dense.data(), [this](const float v) { return IsMissing(v); },
+        values.data());
+    for (int t : quick_scorer_.FallbackTrees()) {
+      values[t] = predict_one_in_a_tree(dense.data(), trees[t]);
+    }
+    for (size_t t = 0; t < values.size(); ++t) out[t % num_class] += values[t];
+  } else if (param_.predictor == "compact") {
+    // the bins of the features which aren't used by the trees are not read
+    static thread_local std::vector<uint16_t> bins;
+    static thread_local std::vector<float> values;
+    bins.resize(num_features_);
+    values.resize(trees.size());
+    compact_model_.Bin(
+        dense.data(), [this](const float v) { return IsMissing(v); },
+        bins.data());
+    compact_model_.Predict(bins.data(), values.data());
+    for (int t : compact_model_.FallbackTrees()) {
+      values[t] = predict_one_in_a_tree(dense.data(), trees[t]);
+    }
+    for (size_t t = 0; t < values.size(); ++t) out[t % num_class] += values[t];
+  } else {
+    for (size_t t = 0; t < trees.size(); ++t) {
+      out[t % num_class] += predict_one_in_a_tree(dense.data(), trees[t]);
+    }
+  }
+  for (dim_t k = 0; k < nnz; ++k) {
+    if (indices[k] < num_features_) dense[indices[k]] = 0;
   }
-  return objective->predict(out);
 }
 
 float BoostedTree::Impl::predict_one_in_a_tree(const CSRRow<float> &X,
                                                int root) const {
+  const Node *nodes = ModelNodes();
   while (1) {
-    const Node &node = *nodes_[root];
+    const Node &node = nodes[root];
     if (node.is_leaf) return node.value;
     const float feat = X[node.feature_id];
-    bool is_left = std::isnan(feat) ? node.miss_left : feat < node.value;
-    root = is_left ? node.left : node.right;
+    bool is_left = IsMissing(feat) ? node.miss_left : feat < node.value;
+    root = is_left ? node.left : node.right();
+  }
+  return 0;
+}
+
+float BoostedTree::Impl::predict_one_in_a_tree(const float *x,
+                                               int root) const {
+  const Node *nodes = ModelNodes();
+  while (1) {
+    const Node &node = nodes[root];
+    if (node.is_leaf) return node.value;
+    const float feat = x[node.feature_id];
+    bool is_left = IsMissing(feat) ? node.miss_left : feat < node.value;
+    root = is_left ? node.left : node.right();
   }
   return 0;
 }
@@ -122,7 +669,7 @@ std::string BoostedTree::Impl::str() const {
     ss << "Tree " << t + 1 << ":\n";
     std::function<void(const int, const int)> F;
     F = [&](const int nid, const int height) {
-      const Node &node = *nodes_[nid];
+      const Node &node = ModelNodes()[nid];
       std::string space(height, '\t');
       if (node.is_leaf) {
         ss << space << "predict: " << node.value << '\n';
@@ -134,148 +681,817 @@ std::string BoostedTree::Impl::str() const {
         ss << space << "f" << node.feature_id << " >= " << node.value;
         if (!node.miss_left) ss << " or missing";
         ss << '\n';
-        F(node.right, height + 1);
+        F(node.right(), height + 1);
+      }
+    };
+    F(trees[t], 1);
+  }
+  return ss.str();
+}
+
+std::string BoostedTree::Impl::export_cpp() const {
+  CHECK(param_.objective == "reg:linear" ||
+        param_.objective == "binary:logistic")
+      << "Not supported to export the objective " << param_.objective;
+  // the floats are written in hexadecimal to be exact
+  auto literal = [](const float value) {
+    std::stringstream ss;
+    if (std::isinf(value)) {
+      ss << (value < 0 ? "-" : "") << "std::numeric_limits<float>::infinity()";
+    } else {
+      ss << std::hexfloat << value << "f";
+    }
+    return ss.str();
+  };
+  std::stringstream ss;
+  ss << "// Generated by BoostedTree::export_cpp, objective: "
+     << param_.objective << "\n";
+  ss << "#include <cmath>\n#include <limits>\n\n";
+  ss << "namespace {\n";
+  const int num_trees = trees.size();
+  for (int t = 0; t < num_trees; ++t) {
+    ss << "\nfloat tree" << t << "(const float *x) {\n";
+    std::function<void(const int, const int)> F;
+    F = [&](const int nid, const int height) {
+      const Node &node = ModelNodes()[nid];
+      std::string space(height * 2, ' ');
+      if (node.is_leaf) {
+        ss << space << "return " << literal(node.value) << ";\n";
+        return;
       }
+      // a NaN fails every comparison
+      const std::string feat = "x[" + std::to_string(node.feature_id) + "]";
+      const std::string value = literal(node.value);
+      ss << space << "if (";
+      if (node.miss_left) {
+        if (param_.zero_as_missing) ss << feat << " == 0 || ";
+        ss << "!(" << feat << " >= " << value << ")";
+      } else {
+        if (param_.zero_as_missing) ss << feat << " != 0 && ";
+        ss << feat << " < " << value;
+      }
+      ss << ") {\n";
+      F(node.left, height + 1);
+      ss << space << "} else {\n";
+      F(node.right(), height + 1);
+      ss << space << "}\n";
     };
     F(trees[t], 1);
+    ss << "}\n";
+  }
+  ss << "\n}  // namespace\n\n";
+  ss << "extern \"C\" int boosted_tree_num_features() { return "
+     << num_features_ << "; }\n\n";
+  ss << "// x is a dense row, whose missing entries are zeros or NaNs\n";
+  ss << "extern \"C\" float boosted_tree_predict(const float *x) {\n";
+  ss << "  float out = " << literal(base_margin_) << ";\n";
+  for (int t = 0; t < num_trees; ++t) {
+    ss << "  out += tree" << t << "(x);\n";
+  }
+  if (param_.objective == "binary:logistic") {
+    ss << "  return 1.0f / (1.0f + exp(-out));\n";
+  } else {
+    ss << "  return out;\n";
   }
+  ss << "}\n";
   return ss.str();
 }
 
-int BoostedTree::Impl::GetNewNodeID() {
-  std::lock_guard<std::mutex> lck(nodes_alloc_mtx_);
-  int id;
-  if (free_nodes_queue_.empty()) {
-    id = nodes_.size();
-    nodes_.resize(id + 1);
-    nodes_[id] = new Node();
+void BoostedTree::Impl::save_model(const std::string &fname) const {
+  std::ofstream fout(fname, std::ios::binary);
+  CHECK(fout.is_open()) << "Open file " << fname << " fail!";
+  const std::string buf = save_raw();
+  fout.write(buf.data(), buf.size());
+  CHECK(fout.good()) << "Write file " << fname << " fail!";
+}
+
+void BoostedTree::Impl::load_model(const std::string &fname) {
+  auto file = std::make_shared<MappedFile>(fname);
+  LoadModel(file->data(), file->size(), file);
+}
+
+std::string BoostedTree::Impl::save_raw() const {
+  CHECK(IsLittleEndian()) << "The model format is little-endian";
+  std::stringstream ps;
+  ps << std::setprecision(std::numeric_limits<float>::max_digits10);
+  VisitParams(param_, [&ps](const char *name, const auto &value) {
+    ps << name << ' ' << value << '\n';
+  });
+  const std::string params = ps.str();
+  const size_t num_nodes = NumModelNodes();
+  ModelHeader header{};
+  std::memcpy(header.magic, kModelMagic, sizeof(header.magic));
+  header.version = kModelVersion;
+  header.num_features = num_features_;
+  header.num_trees = trees.size();
+  header.num_nodes = num_nodes;
+  header.params_size = params.size();
+  header.base_margin = base_margin_;
+  const size_t trees_offset = ModelAlign(sizeof(header) + params.size());
+  const size_t nodes_offset =
+      ModelAlign(trees_offset + trees.size() * sizeof(int32_t));
+  std::string buf(nodes_offset + num_nodes * sizeof(Node), '\0');
+  std::memcpy(&buf[0], &header, sizeof(header));
+  std::memcpy(&buf[sizeof(header)], params.data(), params.size());
+  std::memcpy(&buf[trees_offset], trees.data(), trees.size() * sizeof(int32_t));
+  const Node *nodes = ModelNodes();
+  for (size_t i = 0; i < num_nodes; ++i) {
+    // the padding bytes are written as zeros
+    Node node;
+    std::memset(&node, 0, sizeof(node));
+    node.left = nodes[i].left;
+    node.feature_id = nodes[i].feature_id;
+    node.value = nodes[i].value;
+    node.is_leaf = nodes[i].is_leaf;
+    node.miss_left = nodes[i].miss_left;
+    std::memcpy(&buf[nodes_offset + i * sizeof(Node)], &node, sizeof(node));
+  }
+  return buf;
+}
+
+void BoostedTree::Impl::load_raw(const std::string &buf) {
+  LoadModel(buf.data(), buf.size(), nullptr);
+}
+
+void BoostedTree::Impl::LoadModel(const char *data, const size_t size,
+                                  std::shared_ptr<MappedFile> file) {
+  CHECK(IsLittleEndian()) << "The model format is little-endian";
+  ModelHeader header;
+  CHECK_GE(size, sizeof(header)) << "The model is truncated";
+  std::memcpy(&header, data, sizeof(header));
+  CHECK(std::memcmp(header.magic, kModelMagic, sizeof(header.magic)) == 0)
+      << "Not a model of BoostedTree";
+  CHECK(header.version >= 1 && header.version <= kModelVersion)
+      << "Not supported model version " << header.version;
+  const size_t trees_offset = ModelAlign(sizeof(header) + header.params_size);
+  const size_t nodes_offset =
+      ModelAlign(trees_offset + header.num_trees * sizeof(int32_t));
+  CHECK_LE(nodes_offset + header.num_nodes * sizeof(Node), size)
+      << "The model is truncated";
+  // n_jobs and predictor are the settings of this process
+  BoostedTreeParam param;
+  std::stringstream ps(std::string(data + sizeof(header), header.params_size));
+  std::string name;
+  while (ps >> name) {
+    bool found = false;
+    VisitParams(param, [&](const char *key, auto &value) {
+      if (name == key) {
+        ps >> value;
+        found = true;
+      }
+    });
+    if (!found) {
+      LOG(WARNING) << "Unknown param " << name << " in the model";
+      std::getline(ps, name);
+    }
+  }
+  param.n_jobs = param_.n_jobs;
+  param.predictor = param_.predictor;
+  param_ = param;
+  objective = Registry<Objective<float>>::Find(param_.objective);
+  CHECK(objective) << "Not supported objective " << param_.objective;
+  // the tree t of a multi-class model is of the class t % num_class
+  if (objective->multiclass()) {
+    CHECK_GE(param_.num_class, 2) << " Bad num_class of " << param_.objective;
+  } else {
+    CHECK_EQ(param_.num_class, 1) << " Bad num_class of " << param_.objective;
+  }
+  CHECK_EQ(header.num_trees % static_cast<uint32_t>(param_.num_class), 0)
+      << " The trees don't fill the classes";
+  num_features_ = header.num_features;
+  base_margin_ = header.version >= 2 ? header.base_margin : 0;
+  trees.resize(header.num_trees);
+  std::memcpy(trees.data(), data + trees_offset,
+              header.num_trees * sizeof(int32_t));
+  if (file) {
+    mapped_file_ = file;
+    mapped_nodes_ = reinterpret_cast<const Node *>(data + nodes_offset);
+    num_mapped_nodes_ = header.num_nodes;
+    nodes_.clear();
   } else {
-    id = free_nodes_queue_.front();
-    free_nodes_queue_.pop();
+    mapped_file_.reset();
+    nodes_.resize(header.num_nodes);
+    std::memcpy(nodes_.data(), data + nodes_offset,
+                header.num_nodes * sizeof(Node));
   }
-  DCHECK_LT(id, nodes_.size());
+  // the nodes are read without bounds checks in prediction, and the nodes of
+  // a tree are [trees[t], trees[t + 1]) whose children follow their parents,
+  // so that a traversal ends in its tree
+  const Node *nodes = ModelNodes();
+  const int64_t num_nodes = header.num_nodes;
+  const int num_trees = trees.size();
+  for (int t = 0; t < num_trees; ++t) {
+    const int64_t begin = trees[t];
+    const int64_t end = t + 1 < num_trees ? trees[t + 1] : num_nodes;
+    CHECK(begin >= 0 && begin < end && end <= num_nodes)
+        << "Bad tree root " << begin;
+    for (int64_t i = begin; i < end; ++i) {
+      if (nodes[i].is_leaf) continue;
+      CHECK(nodes[i].left > i && nodes[i].left + 1 < end &&
+            nodes[i].feature_id >= 0 && nodes[i].feature_id < num_features_)
+          << "Bad node " << i;
+    }
+  }
+  BuildPredictor();
+}
+
+void BoostedTree::Impl::load_xgboost_model(const std::string &fname) {
+  ImportModel(ParseXGBoostJSON(ReadFile(fname)));
+}
+
+void BoostedTree::Impl::load_lightgbm_model(const std::string &fname) {
+  ImportModel(ParseLightGBMText(ReadFile(fname)));
+}
+
+void BoostedTree::Impl::ImportModel(const ImportedModel &model) {
+  param_.objective = model.objective;
+  param_.num_class = 1;
+  objective = Registry<Objective<float>>::Find(param_.objective);
+  CHECK(objective) << "Not supported objective " << param_.objective;
+  if (model.zero_as_missing >= 0) {
+    param_.zero_as_missing = model.zero_as_missing;
+  }
+  num_features_ = model.num_features;
+  base_margin_ = model.base_margin;
+  mapped_file_.reset();
+  nodes_.clear();
+  trees.clear();
+  for (const ImportedTree &tree : model.trees) {
+    const int num_nodes = tree.left.size();
+    CHECK_GT(num_nodes, 0) << " Empty tree";
+    const int root = AllocNodes(1);
+    trees.push_back(root);
+    // (the node of the imported tree, the node id), a node reached twice
+    // is in a cycle or shared by two parents
+    std::stack<std::pair<int, int>> stk;
+    std::vector<char> visited(num_nodes, 0);
+    stk.emplace(0, root);
+    while (!stk.empty()) {
+      const int src = stk.top().first, nid = stk.top().second;
+      stk.pop();
+      CHECK(!visited[src]) << "Node " << src
+                           << " of the imported tree is reached twice";
+      visited[src] = 1;
+      if (tree.is_leaf[src]) {
+        nodes_[nid].is_leaf = true;
+        nodes_[nid].value = tree.value[src];
+        continue;
+      }
+      CHECK(tree.left[src] > 0 && tree.left[src] < num_nodes &&
+            tree.right[src] > 0 && tree.right[src] < num_nodes &&
+            tree.feature_id[src] >= 0 &&
+            tree.feature_id[src] < num_features_)
+          << "Bad node " << src << " of the imported tree";
+      const int left = AllocNodes(2);
+      Node &node = nodes_[nid];
+      node.is_leaf = false;
+      node.left = left;
+      node.feature_id = tree.feature_id[src];
+      node.value = tree.value[src];
+      node.miss_left = tree.miss_left[src];
+      stk.emplace(tree.left[src], left);
+      stk.emplace(tree.right[src], left + 1);
+    }
+  }
+  BuildPredictor();
+}
+
+void BoostedTree::Impl::BuildPredictor() {
+  margin_caches_.clear();
+  const Node *nodes = ModelNodes();
+  const int num_trees = trees.size();
+  leaf_ranges_.resize(num_trees);
+  for (int t = 0; t < num_trees; ++t) {
+    // the nodes of a tree are contiguous
+    const int end =
+        t + 1 < num_trees ? trees[t + 1] : static_cast<int>(NumModelNodes());
+    float lo = FLT_MAX, hi = -FLT_MAX;
+    for (int nid = trees[t]; nid < end; ++nid) {
+      if (!nodes[nid].is_leaf) continue;
+      lo = std::min(lo, nodes[nid].value);
+      hi = std::max(hi, nodes[nid].value);
+    }
+    leaf_ranges_[t] = {lo, hi};
+  }
+  if (param_.predictor == "quickscorer") {
+    quick_scorer_.Build(ModelNodes(), trees);
+  } else if (param_.predictor == "compact") {
+    compact_model_.Build(ModelNodes(), trees, num_features_);
+  }
+}
+
+void BoostedTree::Impl::ComputeGradients(
+    const std::vector<Vec<float>> &integrals) {
+  // the gradients of all samples are computed once per boosting round, per
+  // block of samples, so that the objective is called once per block
+  constexpr int kBlockSize = 4096;
+  const int num_samples = gpair_.size();
+  const int num_blocks = (num_samples + kBlockSize - 1) / kBlockSize;
+  const int num_class = integrals.size();
+  if (num_class == 1) {
+#pragma omp parallel for num_threads(param_.n_jobs)
+    for (int b = 0; b < num_blocks; ++b) {
+      const int first = b * kBlockSize;
+      objective->gradient_hessian(&integrals[0][first], &Y_[first],
+                                  &gpair_[first],
+                                  std::min(kBlockSize, num_samples - first));
+    }
+    return;
+  }
+  // the margins of all the classes are packed into the row-major matrix
+  // margins_, and the softmax gradients of a row are computed together
+  margins_.resize(size_t(num_samples) * num_class);
+  class_gpair_.resize(size_t(num_samples) * num_class);
+#pragma omp parallel for num_threads(param_.n_jobs)
+  for (int b = 0; b < num_blocks; ++b) {
+    const int first = b * kBlockSize;
+    const int last = std::min(first + kBlockSize, num_samples);
+    for (int i = first; i < last; ++i) {
+      for (int k = 0; k < num_class; ++k) {
+        margins_[size_t(i) * num_class + k] = integrals[k][i];
+      }
+    }
+    objective->gradient_hessian_multi(
+        &margins_[size_t(first) * num_class], &Y_[first],
+        &class_gpair_[size_t(first) * num_class], last - first, num_class);
+  }
+}
+
+void BoostedTree::Impl::SelectClassGradients(const int k) {
+  const int num_samples = gpair_.size();
+  const int num_class = param_.num_class;
+#pragma omp parallel for num_threads(param_.n_jobs)
+  for (int i = 0; i < num_samples; ++i) {
+    gpair_[i] = class_gpair_[size_t(i) * num_class + k];
+  }
+}
+
+int BoostedTree::Impl::SampleRows(const int iter) {
+  const int num_samples = gpair_.size();
+  // LightGBM doesn't use GOSS in the first 1 / learning_rate rounds
+  const bool using_goss = param_.sampling_method == "goss" &&
+                          iter > int(1.0f / param_.learning_rate);
+  if (!using_goss && param_.subsample >= 1) {
+    partitioner_.Reset(num_samples);
+    return num_samples;
+  }
+  float top_threshold = FLT_MAX;
+  float other_prob = param_.subsample;
+  float other_weight = 1;
+  if (using_goss) {
+    // keep the top_rate rows with the largest |gradient|, sample other_rate
+    // rows from the rest and amplify their gradients
+    std::vector<float> abs_gradients(num_samples);
+    for (int i = 0; i < num_samples; ++i) {
+      abs_gradients[i] = std::abs(gpair_[i].gradient);
+    }
+    const int num_top = std::max(1, int(num_samples * param_.top_rate));
+    std::nth_element(abs_gradients.begin(),
+                     abs_gradients.begin() + num_top - 1, abs_gradients.end(),
+                     std::greater<float>());
+    top_threshold = abs_gradients[num_top - 1];
+    other_prob = std::min(1.0f, param_.other_rate / (1 - param_.top_rate));
+    other_weight = (1 - param_.top_rate) / param_.other_rate;
+  }
+  // the rows are sampled in fixed blocks with their own generators,
+  // so the samples don't depend on n_jobs
+  const int block_size = 4096;
+  const int num_blocks = (num_samples + block_size - 1) / block_size;
+#pragma omp parallel for num_threads(param_.n_jobs)
+  for (int b = 0; b < num_blocks; ++b) {
+    std::seed_seq seq{param_.seed, iter, b};
+    std::mt19937 rng(seq);
+    std::uniform_real_distribution<float> uniform(0, 1);
+    const int end = std::min(num_samples, (b + 1) * block_size);
+    for (int i = b * block_size; i < end; ++i) {
+      GradientInfo &g = gpair_[i];
+      if (std::abs(g.gradient) >= top_threshold) {
+        row_sampled_[i] = 1;
+      } else if (uniform(rng) < other_prob) {
+        row_sampled_[i] = 1;
+        g.gradient *= other_weight;
+        g.hessian *= other_weight;
+      } else {
+        row_sampled_[i] = 0;
+      }
+    }
+  }
+  sampled_rows_.clear();
+  for (int i = 0; i < num_samples; ++i) {
+    if (row_sampled_[i]) {
+      sampled_rows_.push_back(i);
+    } else {
+      // the rows out of the tree never match a node
+      positions_[i] = -1;
+    }
+  }
+  if (sampled_rows_.empty()) {
+    row_sampled_[0] = 1;
+    sampled_rows_.push_back(0);
+  }
+  partitioner_.Reset(sampled_rows_);
+  return sampled_rows_.size();
+}
+
+int BoostedTree::Impl::AllocNodes(const int num_nodes) {
+  // the nodes are only allocated by the thread building the tree
+  const int id = nodes_.size();
+  nodes_.resize(id + num_nodes);
   return id;
 }
 
-int BoostedTree::Impl::CreateNode(Vec<float> &integrals,
-                                  const std::vector<int> &sample_ids,
-                                  const std::vector<int> &feature_ids,
-                                  const int depth) {
-  const int nid = GetNewNodeID();
-  Node &node = *nodes_[nid];
+void BoostedTree::Impl::BuildTree(const int root, Vec<float> &integrals,
+                                  const size_t num_samples,
+                                  const std::vector<int> &feature_ids) {
+  ExpandEntry root_entry;
+  root_entry.nid = root;
+  root_entry.begin = 0;
+  root_entry.end = num_samples;
+  root_entry.depth = 1;
+  tree_feature_ids_ = SampleFeatures(feature_ids, param_.colsample_bytree);
+  root_entry.feature_ids = tree_feature_ids_;
+  level_feature_ids_.clear();
+  if (param_.grow_policy == "lossguide") {
+    // expand the leaf with the largest loss reduction first
+    auto cmp = [](const ExpandEntry &a, const ExpandEntry &b) {
+      return a.loss_chg < b.loss_chg ||
+             (a.loss_chg == b.loss_chg && a.nid > b.nid);
+    };
+    std::priority_queue<ExpandEntry, std::vector<ExpandEntry>, decltype(cmp)>
+        candidates(cmp);
+    EvaluateSplits(&root_entry, 1);
+    candidates.push(std::move(root_entry));
+    int num_leaves = 1;
+    std::vector<ExpandEntry> children;
+    while (!candidates.empty()) {
+      ExpandEntry entry = candidates.top();
+      candidates.pop();
+      if (param_.max_leaves > 0 && num_leaves >= param_.max_leaves) {
+        MakeLeaf(entry, integrals);
+        continue;
+      }
+      children.clear();
+      ApplySplits(&entry, 1, &children, integrals);
+      if (children.empty()) continue;
+      ++num_leaves;
+      EvaluateSplits(children.data(), children.size());
+      for (ExpandEntry &child : children) candidates.push(std::move(child));
+    }
+  } else {
+    // the nodes of a level are expanded together, and the histograms of a
+    // batch of nodes and their children should stay in the cache
+    const size_t batch_size =
+        param_.tree_method == "hist"
+            ? std::max(1, param_.max_cached_hist_node / 3)
+            : std::numeric_limits<size_t>::max();
+    std::vector<ExpandEntry> level, next_level;
+    level.push_back(std::move(root_entry));
+    while (!level.empty()) {
+      next_level.clear();
+      for (size_t first = 0; first < level.size(); first += batch_size) {
+        const int num_entries =
+            std::min(batch_size, level.size() - first);
+        EvaluateSplits(level.data() + first, num_entries);
+        ApplySplits(level.data() + first, num_entries, &next_level,
+                    integrals);
+      }
+      std::swap(level, next_level);
+    }
+  }
+}
 
-  const size_t num_samples = sample_ids.size();
-  const size_t num_subsamples =
-      std::max(static_cast<size_t>(1),
-               static_cast<size_t>(num_samples * param_.subsample));
-  std::vector<int> subsample_ids = sample_ids;
-  if (param_.subsample < 1) {
-    std::random_shuffle(subsample_ids.begin(), subsample_ids.end());
-    subsample_ids.resize(num_subsamples);
-  }
-
-  Vec<float> part_integrals(num_subsamples);
-  for (int i = 0; i < num_subsamples; ++i) {
-    part_integrals[i] = integrals[subsample_ids[i]];
-  }
-  Vec<float> part_labels(num_subsamples);
-  for (int i = 0; i < num_subsamples; ++i) {
-    part_labels[i] = Y_[subsample_ids[i]];
-  }
-
-  bool gen_leaf = true;
-  if (param_.max_depth <= 0 || depth <= param_.max_depth) {
-    if (num_subsamples > 1) {
-      // TODO: 如何在回归问题中中止
-      gen_leaf = false;
-    }
-  }
-  // compute gradient and hessian
-  Vec<float> gradients(num_subsamples), hessians(num_subsamples);
-  for (int i = 0; i < num_subsamples; ++i) {
-    gradients[i] = objective->gradient(part_integrals[i], part_labels[i]);
-  }
-  for (int i = 0; i < num_subsamples; ++i) {
-    hessians[i] = objective->hessian(part_integrals[i], part_labels[i]);
-  }
-  const float G_sum = Sum(gradients);
-  const float H_sum = Sum(hessians);
-  float best_gain = GetGain(G_sum, H_sum) + param_.gamma * 2;
-
-  bool using_exact_hist =
-      (param_.tree_method == "exact" ||
-       num_subsamples <= size_t(TREE_METHOD_APPROX_RATIO / param_.sketch_eps));
-  if (!gen_leaf && !feature_ids.empty()) {
-    SplitInfo best_info;
-    best_info.feature_id = -1;
-    std::vector<int> new_feature_ids;
-    const int num_features = feature_ids.size();
+void BoostedTree::Impl::EvaluateSplits(ExpandEntry *entries,
+                                       const int num_entries) {
+  // active: the nodes which may be split
+  std::vector<char> active(num_entries);
 #pragma omp parallel for num_threads(param_.n_jobs)
-    for (int i = 0; i < num_features; ++i) {
-      int feature_id = feature_ids[i];
-      SplitInfo info =
-          using_exact_hist
-              ? GetExactSplitInfo(subsample_ids, feature_id, gradients, G_sum,
-                                  hessians, H_sum)
-              : GetApproxSplitInfo(subsample_ids, feature_id, gradients, G_sum,
-                                   hessians, H_sum);
-#pragma omp critical
-      if (info.feature_id != -1) {
-        new_feature_ids.push_back(info.feature_id);
-        if (info.gain > best_gain) {
-          best_gain = info.gain;
-          best_info = info;
-        }
+  for (int n = 0; n < num_entries; ++n) {
+    ExpandEntry &entry = entries[n];
+    const size_t num_samples = entry.end - entry.begin;
+    const RowSlice sample_ids = partitioner_.Slice(entry.begin, entry.end);
+    float G_sum = 0, H_sum = 0;
+    for (int i : sample_ids) {
+      const GradientInfo &g = gpair_[i];
+      G_sum += g.gradient;
+      H_sum += g.hessian;
+    }
+    entry.G_sum = G_sum;
+    entry.H_sum = H_sum;
+    entry.info.feature_id = -1;
+    entry.info.gain = GetGain(G_sum, H_sum) + param_.gamma * 2;
+    entry.loss_chg = 0;
+    bool gen_leaf = true;
+    if (param_.max_depth <= 0 || entry.depth <= param_.max_depth) {
+      if (num_samples > 1) {
+        // TODO: 如何在回归问题中中止
+        gen_leaf = false;
       }
     }
+    active[n] = !gen_leaf && !entry.feature_ids.empty();
+    if (active[n]) {
+      for (int i : sample_ids) positions_[i] = entry.nid;
+    }
+  }
 
-    if (best_info.feature_id != -1) {
-      // split
-      node.is_leaf = false;
-      node.feature_id = best_info.feature_id;
-      node.miss_left = best_info.miss_left;
-      const float split = best_info.split;
-      node.value = split;
-
-      std::vector<int> left_sample_ids, right_sample_ids;
-      CSRRow<float> sfeat = XT_[best_info.feature_id];
-      Vec<float> feat = sfeat.at(sample_ids.begin(), sample_ids.end());
-      for (int i = 0; i < num_samples; ++i) {
-        /*
-         * left:
-         *   isnan(feat[i]) == false && feat[i] < split
-         *   isnan(feat[i]) == true && node.miss_left == true
-         *   (A && B) || (!A && C)
-         */
-        if ((!std::isnan(feat[i]) && feat[i] < split) ||
-            (std::isnan(feat[i]) && node.miss_left))
-          left_sample_ids.push_back(sample_ids[i]);
-        else
-          right_sample_ids.push_back(sample_ids[i]);
-      }
-
-      // subtree
-      node.left =
-          CreateNode(integrals, left_sample_ids, new_feature_ids, depth + 1);
-      node.right =
-          CreateNode(integrals, right_sample_ids, new_feature_ids, depth + 1);
-      return nid;
-    }
-  }
-
-  // leaf
+  // the features of a node are sampled from the features of its level,
+  // the histogram is still built for all the features of the node
+  const bool sampling_features =
+      param_.colsample_bylevel < 1 || param_.colsample_bynode < 1;
+  std::vector<std::vector<int>> sampled_feature_ids;
+  if (sampling_features) {
+    sampled_feature_ids.resize(num_entries);
+    for (int n = 0; n < num_entries; ++n) {
+      if (!active[n]) continue;
+      const ExpandEntry &entry = entries[n];
+      const std::vector<int> &level_feature_ids = LevelFeatures(entry.depth);
+      std::vector<int> feature_ids;
+      std::set_intersection(entry.feature_ids.begin(), entry.feature_ids.end(),
+                            level_feature_ids.begin(), level_feature_ids.end(),
+                            std::back_inserter(feature_ids));
+      sampled_feature_ids[n] =
+          SampleFeatures(feature_ids, param_.colsample_bynode);
+    }
+  }
+  auto candidates_of = [&](const int n) -> const std::vector<int> & {
+    return sampling_features ? sampled_feature_ids[n] : entries[n].feature_ids;
+  };
+
+  const bool using_hist = param_.tree_method == "hist";
+  const bool using_sorted_columns = param_.tree_method == "exact";
+  // (node, feature) pairs, offsets[n]: the first pair of the n-th node
+  std::vector<size_t> offsets(num_entries + 1, 0);
+  std::vector<HistBin *> hists(num_entries, nullptr);
+  std::vector<HistTask> tasks;
+  for (int n = 0; n < num_entries; ++n) {
+    const ExpandEntry &entry = entries[n];
+    offsets[n + 1] = offsets[n] + (active[n] ? candidates_of(n).size() : 0);
+    if (using_hist && active[n]) {
+      // the histogram may be derived by the parent node
+      hists[n] = hist_pool_.Get(entry.nid);
+    }
+  }
+  if (using_hist) {
+    for (int n = 0; n < num_entries; ++n) {
+      if (!active[n] || hists[n] != nullptr) continue;
+      const ExpandEntry &entry = entries[n];
+      hists[n] = hist_pool_.Alloc(entry.nid);
+      HistTask task;
+      task.nid = entry.nid;
+      task.sample_ids = partitioner_.Slice(entry.begin, entry.end);
+      task.feature_ids = &entry.feature_ids;
+      task.hist = hists[n];
+      tasks.push_back(task);
+    }
+    BuildHists(&tasks);
+  }
+
+  // find the best split of every (node, feature) pair,
+  // every pair writes its own slot
+  const size_t num_pairs = offsets.back();
+  if (split_infos_.size() < num_pairs) split_infos_.resize(num_pairs);
+#pragma omp parallel for num_threads(param_.n_jobs) schedule(dynamic)
+  for (size_t k = 0; k < num_pairs; ++k) {
+    const int n =
+        std::upper_bound(offsets.begin(), offsets.end(), k) - offsets.begin() -
+        1;
+    const ExpandEntry &entry = entries[n];
+    const int feature_id = candidates_of(n)[k - offsets[n]];
+    const size_t num_samples = entry.end - entry.begin;
+    const float G_sum = entry.G_sum, H_sum = entry.H_sum;
+    SplitInfo info;
+    if (using_hist) {
+      info = GetHistSplitInfo(feature_id,
+                              hists[n] + bins_.FeatureBinBegin(feature_id),
+                              G_sum, H_sum);
+    } else {
+      const RowSlice sample_ids = partitioner_.Slice(entry.begin, entry.end);
+      const bool using_exact_hist =
+          param_.tree_method == "exact" ||
+          num_samples <= size_t(TREE_METHOD_APPROX_RATIO / param_.sketch_eps);
+      // scanning a pre-sorted column is cheaper than sorting the samples of
+      // a large node
+      const size_t max_scan_entries =
+          num_samples * std::max(1, int(std::log2(num_samples)));
+      if (using_sorted_columns &&
+          columns_.NumEntries(feature_id) <= max_scan_entries) {
+        info = GetSortedSplitInfo(entry.nid, num_samples, feature_id, G_sum,
+                                  H_sum);
+      } else {
+        info = using_exact_hist
+                   ? GetExactSplitInfo(sample_ids, feature_id, G_sum, H_sum)
+                   : GetApproxSplitInfo(entry.nid, sample_ids, feature_id,
+                                        G_sum, H_sum);
+      }
+    }
+    split_infos_[k] = info;
+  }
+  // reduce in the order of the features, the result doesn't depend on n_jobs
+  for (int n = 0; n < num_entries; ++n) {
+    if (!active[n]) continue;
+    ExpandEntry &entry = entries[n];
+    // the children select features from the valid features of the node
+    // if all the features are evaluated
+    std::vector<int> &feature_ids = entry.feature_ids;
+    int num_valid_features = 0;
+    for (size_t k = offsets[n]; k < offsets[n + 1]; ++k) {
+      const SplitInfo &info = split_infos_[k];
+      if (info.feature_id == -1) continue;
+      if (!sampling_features)
+        feature_ids[num_valid_features++] = info.feature_id;
+      if (info.gain > entry.info.gain) entry.info = info;
+    }
+    if (!sampling_features) feature_ids.resize(num_valid_features);
+    if (entry.info.feature_id != -1)
+      entry.loss_chg = entry.info.gain - GetGain(entry.G_sum, entry.H_sum);
+  }
+}
+
+void BoostedTree::Impl::ApplySplits(const ExpandEntry *entries,
+                                    const int num_entries,
+                                    std::vector<ExpandEntry> *children,
+                                    Vec<float> &integrals) {
+  // left: [begin, mid), right: [mid, end)
+  std::vector<size_t> mids(num_entries);
+  // a large node is partitioned by all threads, the nodes of a level are
+  // partitioned concurrently, the regions aren't nested
+  const int n_jobs = num_entries == 1 ? param_.n_jobs : 1;
+  const bool using_hist = param_.tree_method == "hist";
+#pragma omp parallel for num_threads(n_jobs > 1 ? 1 : param_.n_jobs) \
+    schedule(dynamic)
+  for (int n = 0; n < num_entries; ++n) {
+    const ExpandEntry &entry = entries[n];
+    const SplitInfo &best_info = entry.info;
+    if (best_info.feature_id == -1) {
+      mids[n] = entry.begin;
+      continue;
+    }
+    const int feature_id = best_info.feature_id;
+    const int column_id = using_hist ? bins_.FeatureColumn(feature_id) : -1;
+    if (using_hist && bins_.IsDense(column_id)) {
+      // x < split iff bin(x) < bin(split) for the cut values
+      const int split_bin = bins_.ValueToBin(feature_id, best_info.split);
+      const int missing_bin = bins_.MissingBin(feature_id);
+      const bool miss_left = best_info.miss_left;
+      auto go_left = [&](const auto *column) {
+        return [=](const int i) {
+          const int bin = column[i];
+          return bin == missing_bin ? miss_left : bin < split_bin;
+        };
+      };
+      if (bins_.IsCompact()) {
+        mids[n] = partitioner_.Partition(
+            entry.begin, entry.end,
+            go_left(bins_.Column<uint8_t>(column_id)), n_jobs);
+      } else {
+        mids[n] = partitioner_.Partition(
+            entry.begin, entry.end,
+            go_left(bins_.Column<uint16_t>(column_id)), n_jobs);
+      }
+      continue;
+    }
+    GatherGoLeft(best_info, partitioner_.Slice(entry.begin, entry.end),
+                 n_jobs);
+    mids[n] = partitioner_.Partition(
+        entry.begin, entry.end, [&](const int i) { return go_left_[i]; },
+        n_jobs);
+  }
+
+  std::vector<HistTask> tasks;
+  for (int n = 0; n < num_entries; ++n) {
+    const ExpandEntry &entry = entries[n];
+    const size_t begin = entry.begin, mid = mids[n], end = entry.end;
+    // never expected, a split candidate has samples on both sides
+    if (mid == begin || mid == end) {
+      MakeLeaf(entry, integrals);
+      continue;
+    }
+    // split
+    const int left = AllocNodes(2);
+    Node &node = nodes_[entry.nid];
+    node.is_leaf = false;
+    node.feature_id = entry.info.feature_id;
+    node.miss_left = entry.info.miss_left;
+    node.value = entry.info.split;
+    node.left = left;
+    for (int c = 0; c < 2; ++c) {
+      ExpandEntry child;
+      child.nid = left + c;
+      child.begin = c == 0 ? begin : mid;
+      child.end = c == 0 ? mid : end;
+      child.depth = entry.depth + 1;
+      child.feature_ids = entry.feature_ids;
+      children->push_back(std::move(child));
+    }
+    // the histogram of the parent may be evicted
+    HistBin *hist = using_hist ? hist_pool_.Get(entry.nid) : nullptr;
+    if (hist != nullptr) {
+      // build the histogram of the smaller child,
+      // and the larger one = parent - smaller one
+      const bool left_is_smaller = mid - begin <= end - mid;
+      HistTask task;
+      task.nid = left_is_smaller ? left : left + 1;
+      task.sample_ids = left_is_smaller ? partitioner_.Slice(begin, mid)
+                                        : partitioner_.Slice(mid, end);
+      task.feature_ids = &entry.feature_ids;
+      task.hist = hist_pool_.Alloc(task.nid);
+      task.parent = hist;
+      task.sibling = hist_pool_.Alloc(left_is_smaller ? left + 1 : left);
+      tasks.push_back(task);
+    }
+  }
+  if (using_hist) {
+    BuildHists(&tasks);
+    for (int n = 0; n < num_entries; ++n) hist_pool_.Release(entries[n].nid);
+  }
+}
+
+void BoostedTree::Impl::GatherGoLeft(const SplitInfo &info,
+                                     const RowSlice &sample_ids,
+                                     const int n_jobs) {
+  const float split = info.split;
+  const bool miss_left = info.miss_left;
+  auto go_left = [&](const float value) {
+    return IsMissing(value) ? miss_left : value < split;
+  };
+  // the samples which aren't stored are zeros
+  const bool zero_left = go_left(0);
+  const CSRRow<float> sfeat = XT_[info.feature_id];
+  const dim_t nnz = sfeat.nnz();
+  const dim_t *indices = sfeat.indices();
+  const dim_t *indices_end = indices + nnz;
+  const float *values = sfeat.values();
+  const size_t num_samples = sample_ids.size();
+  // merge the sorted samples with the sorted column if the column is short,
+  // otherwise search the samples of the small node in the column
+  const bool merge =
+      size_t(nnz) <= num_samples * std::max(1, int(std::log2(nnz + 1)));
+  const size_t block_size = RowPartitioner::kMinBlockRows;
+  const int num_blocks = (num_samples + block_size - 1) / block_size;
+#pragma omp parallel for num_threads(n_jobs)
+  for (int b = 0; b < num_blocks; ++b) {
+    const size_t first = b * block_size;
+    const size_t last = std::min(num_samples, first + block_size);
+    const dim_t *p = std::lower_bound(indices, indices_end, sample_ids[first]);
+    for (size_t k = first; k < last; ++k) {
+      const int i = sample_ids[k];
+      if (merge) {
+        while (p != indices_end && *p < i) ++p;
+      } else {
+        p = std::lower_bound(p, indices_end, i);
+      }
+      go_left_[i] = p != indices_end && *p == i ? go_left(values[p - indices])
+                                                 : zero_left;
+    }
+  }
+}
+
+void BoostedTree::Impl::MakeLeaf(const ExpandEntry &entry,
+                                 Vec<float> &integrals) {
+  if (param_.tree_method == "hist") hist_pool_.Release(entry.nid);
+  Node &node = nodes_[entry.nid];
   node.is_leaf = true;
   // float mean_integral = Mean(part_integrals);
   // float pred = objective->estimate(part_labels) - mean_integral;
-  float pred = -G_sum / (H_sum + param_.reg_lambda);
+  float pred = -entry.G_sum / (entry.H_sum + param_.reg_lambda);
   float pred_factor = pred * param_.learning_rate;
   node.value = pred_factor;
   // update integrals
-  for (int i = 0; i < num_samples; ++i) {
-    float &r = integrals[sample_ids[i]];
-    r += pred_factor;
+  for (int i : partitioner_.Slice(entry.begin, entry.end)) {
+    integrals[i] += pred_factor;
   }
-  return nid;
+}
+
+std::vector<int> BoostedTree::Impl::SampleFeatures(
+    const std::vector<int> &feature_ids, const float rate) {
+  if (rate >= 1) return feature_ids;
+  const int num_features = feature_ids.size();
+  const int num_sampled =
+      std::min(num_features, std::max(1, int(num_features * rate)));
+  std::vector<int> sampled = feature_ids;
+  // partial Fisher-Yates shuffle
+  for (int i = 0; i < num_sampled; ++i) {
+    std::uniform_int_distribution<int> dist(i, num_features - 1);
+    std::swap(sampled[i], sampled[dist(rng_)]);
+  }
+  sampled.resize(num_sampled);
+  std::sort(sampled.begin(), sampled.end());
+  return sampled;
+}
+
+const std::vector<int> &BoostedTree::Impl::LevelFeatures(const int depth) {
+  // sampled from the features of the tree when the level is first reached
+  if (level_feature_ids_.size() <= size_t(depth)) {
+    level_feature_ids_.resize(depth + 1);
+  }
+  std::vector<int> &feature_ids = level_feature_ids_[depth];
+  if (feature_ids.empty()) {
+    feature_ids = SampleFeatures(tree_feature_ids_, param_.colsample_bylevel);
+  }
+  return feature_ids;
+}
+
+bool BoostedTree::Impl::IsMissing(const float value) const {
+  return std::isnan(value) || (param_.zero_as_missing && value == 0);
 }
 
 float BoostedTree::Impl::GetGain(float G, float H) const {
@@ -295,10 +1511,10 @@ Vec<DType> BoostedTree::Impl::ReorderVec(const Vec<DType> &data,
   return out;
 }
 
-SplitInfo BoostedTree::Impl::GetExactSplitInfo(
-    const std::vector<int> &sample_ids, int feature_id,
-    const Vec<float> &gradients, const float G_sum, const Vec<float> &hessians,
-    const float H_sum) {
+SplitInfo BoostedTree::Impl::GetExactSplitInfo(const RowSlice &sample_ids,
+                                               int feature_id,
+                                               const float G_sum,
+                                               const float H_sum) {
   // Basic exact greedy algorithm
   CSRRow<float> sfeat = XT_[feature_id];
   const size_t num_samples = sample_ids.size();
@@ -306,11 +1522,12 @@ SplitInfo BoostedTree::Impl::GetExactSplitInfo(
   std::vector<int> inds(num_samples);
   float G_missing = 0, H_missing = 0;
   int j = 0;
-  // remove nan in inds
+  // remove missing value in inds
   for (int i = 0; i < num_samples; ++i) {
-    if (std::isnan(feat[i])) {
-      G_missing += gradients[i];
-      H_missing += hessians[i];
+    if (IsMissing(feat[i])) {
+      const GradientInfo &g = gpair_[sample_ids[i]];
+      G_missing += g.gradient;
+      H_missing += g.hessian;
     } else {
       inds[j++] = i;
     }
@@ -349,13 +1566,15 @@ SplitInfo BoostedTree::Impl::GetExactSplitInfo(
   bool best_miss_left;
 
   Vec<float> feat_cache = ReorderVec(feat, inds);
-  Vec<float> gradients_cache = ReorderVec(gradients, inds);
-  Vec<float> hessians_cache = ReorderVec(hessians, inds);
+  std::vector<GradientInfo> gpair_cache(num_nonmiss_samples);
+  for (int i = 0; i < num_nonmiss_samples; ++i) {
+    gpair_cache[i] = gpair_[sample_ids[inds[i]]];
+  }
 
   for (float split : splits) {
     while (si < num_nonmiss_samples && feat_cache[si] < split) {
-      G_L += gradients_cache[si];
-      H_L += hessians_cache[si];
+      G_L += gpair_cache[si].gradient;
+      H_L += gpair_cache[si].hessian;
       ++si;
     }
     {
@@ -391,38 +1610,179 @@ SplitInfo BoostedTree::Impl::GetExactSplitInfo(
   return info;
 }
 
+SplitInfo BoostedTree::Impl::GetSortedSplitInfo(const int nid,
+                                                const size_t num_samples,
+                                                int feature_id,
+                                                const float G_sum,
+                                                const float H_sum) {
+  // Sparsity-aware exact greedy algorithm on a pre-sorted column
+  // the samples of the node: stored entries, stored missing entries and
+  // the default bucket (the samples which are not stored)
+  float G_missing = 0, H_missing = 0;
+  size_t num_missing = 0;
+  for (const int *p = columns_.MissingBegin(feature_id);
+       p != columns_.MissingEnd(feature_id); ++p) {
+    if (positions_[*p] != nid) continue;
+    const GradientInfo &g = gpair_[*p];
+    G_missing += g.gradient;
+    H_missing += g.hessian;
+    ++num_missing;
+  }
+  float G_stored = 0, H_stored = 0;
+  size_t num_stored = 0;
+  const ColumnBlock::Entry *entry_begin = columns_.EntryBegin(feature_id);
+  const ColumnBlock::Entry *entry_end = columns_.EntryEnd(feature_id);
+  for (const ColumnBlock::Entry *p = entry_begin; p != entry_end; ++p) {
+    if (positions_[p->index] != nid) continue;
+    const GradientInfo &g = gpair_[p->index];
+    G_stored += g.gradient;
+    H_stored += g.hessian;
+    ++num_stored;
+  }
+  size_t num_default = num_samples - num_stored - num_missing;
+  float G_default = G_sum - G_stored - G_missing;
+  float H_default = H_sum - H_stored - H_missing;
+  if (param_.zero_as_missing && num_default > 0) {
+    G_missing += G_default;
+    H_missing += H_default;
+    num_missing += num_default;
+    num_default = 0;
+  }
+  const bool exist_missing = num_missing > 0;
+
+  float G_L = 0, H_L = 0;
+  float best_gain = FLT_MIN;
+  float best_split;
+  bool best_miss_left;
+  bool first = true;
+  size_t num_splits = 0;
+  float last;
+  auto visit = [&](const float value, const float G, const float H) {
+    if (!first && value != last) {
+      const float split = (last + value) / 2.0;
+      if (num_splits++ == 0) best_split = split;
+      {
+        // try enumerate missing value goto right
+        float G_R = G_sum - G_L;
+        float H_R = H_sum - H_L;
+        float gain = GetGain(G_L, H_L) + GetGain(G_R, H_R);
+        if (gain > best_gain) {
+          best_gain = gain;
+          best_split = split;
+          best_miss_left = false;
+        }
+      }
+      if (exist_missing) {
+        // try enumerate missing value goto left
+        float G_L2 = G_L + G_missing;
+        float H_L2 = H_L + H_missing;
+        float G_R2 = G_sum - G_L2;
+        float H_R2 = H_sum - H_L2;
+        float gain = GetGain(G_L2, H_L2) + GetGain(G_R2, H_R2);
+        if (gain > best_gain) {
+          best_gain = gain;
+          best_split = split;
+          best_miss_left = true;
+        }
+      }
+    }
+    G_L += G;
+    H_L += H;
+    last = value;
+    first = false;
+  };
+  // the default bucket (zero) is visited in order
+  bool default_visited = num_default == 0;
+  for (const ColumnBlock::Entry *p = entry_begin; p != entry_end; ++p) {
+    if (positions_[p->index] != nid) continue;
+    if (!default_visited && p->value >= 0) {
+      visit(0, G_default, H_default);
+      default_visited = true;
+    }
+    const GradientInfo &g = gpair_[p->index];
+    visit(p->value, g.gradient, g.hessian);
+  }
+  if (!default_visited) visit(0, G_default, H_default);
+
+  SplitInfo info;
+  if (num_splits == 0) {
+    info.feature_id = -1;
+    return info;
+  }
+  info.feature_id = feature_id;
+  info.split = best_split;
+  info.gain = best_gain;
+  info.miss_left = best_miss_left;
+  return info;
+}
+
 SplitInfo BoostedTree::Impl::GetApproxSplitInfo(
-    const std::vector<int> &sample_ids, int feature_id,
-    const Vec<float> &gradients, const float G_sum, const Vec<float> &hessians,
-    const float H_sum) {
+    const int nid, const RowSlice &sample_ids, int feature_id,
+    const float G_sum, const float H_sum) {
   // Weighted quantile sketch
+  using pair_t = std::pair<float, GradientInfo>;
+  using quantile_t = Quantile<float, GradientInfo>;
+  using summary_t = quantile_t::Summary;
   CSRRow<float> sfeat = XT_[feature_id];
   const size_t num_samples = sample_ids.size();
-  Vec<float> feat = sfeat.at(sample_ids.begin(), sample_ids.end());
-  std::vector<int> inds(num_samples);
+  // the non-missing values of the samples
+  std::vector<pair_t> entries;
   float G_missing = 0, H_missing = 0;
-  int j = 0;
-  // remove nan in inds
-  for (int i = 0; i < num_samples; ++i) {
-    if (std::isnan(feat[i])) {
-      G_missing += gradients[i];
-      H_missing += hessians[i];
-    } else {
-      inds[j++] = i;
+  size_t num_missing = 0;
+  if (sfeat.nnz() < num_samples) {
+    // sparsity-aware: only visit the stored entries,
+    // the samples which are not stored are in a default bucket
+    const dim_t nnz = sfeat.nnz();
+    const dim_t *indices = sfeat.indices();
+    const float *values = sfeat.values();
+    float G_stored = 0, H_stored = 0;
+    size_t num_stored = 0;
+    for (dim_t k = 0; k < nnz; ++k) {
+      if (positions_[indices[k]] != nid) continue;
+      const GradientInfo &g = gpair_[indices[k]];
+      if (IsMissing(values[k])) {
+        G_missing += g.gradient;
+        H_missing += g.hessian;
+        ++num_missing;
+      } else {
+        entries.emplace_back(values[k], g);
+        G_stored += g.gradient;
+        H_stored += g.hessian;
+        ++num_stored;
+      }
+    }
+    const size_t num_default = num_samples - num_stored - num_missing;
+    if (num_default > 0) {
+      GradientInfo g(G_sum - G_stored - G_missing, H_sum - H_stored - H_missing);
+      if (param_.zero_as_missing) {
+        G_missing += g.gradient;
+        H_missing += g.hessian;
+        num_missing += num_default;
+      } else {
+        entries.emplace_back(0, g);
+      }
+    }
+  } else {
+    Vec<float> feat = sfeat.at(sample_ids.begin(), sample_ids.end());
+    entries.reserve(num_samples);
+    for (int i = 0; i < num_samples; ++i) {
+      const GradientInfo &g = gpair_[sample_ids[i]];
+      if (IsMissing(feat[i])) {
+        G_missing += g.gradient;
+        H_missing += g.hessian;
+        ++num_missing;
+      } else {
+        entries.emplace_back(feat[i], g);
+      }
     }
   }
-  inds.resize(j);
-  using pair_t = std::pair<float, GradientInfo>;
-  using quantile_t = Quantile<float, GradientInfo>;
-  using summary_t = quantile_t::Summary;
   const size_t buffer_size = TREE_METHOD_APPROX_RATIO / param_.sketch_eps;
   const size_t num_buckets = 1.0 / param_.sketch_eps;
   std::vector<pair_t> buf(buffer_size);
   int buf_i = 0;
   summary_t summary;
-  for (int ind : inds) {
-    buf[buf_i++] =
-        pair_t{feat[ind], GradientInfo(gradients[ind], hessians[ind])};
+  for (const pair_t &entry : entries) {
+    buf[buf_i++] = entry;
     if (buf_i >= buffer_size) {
       // merge then prune
       summary_t tmp_summary(buf);
@@ -435,7 +1795,7 @@ SplitInfo BoostedTree::Impl::GetApproxSplitInfo(
     buf.resize(buf_i);
     summary = quantile_t::Merge(summary, summary_t(buf));
   }
-  const bool exist_missing = inds.size() < num_samples;
+  const bool exist_missing = num_missing > 0;
   size_t num_splits = summary.size();
   if (num_splits == 0) {
     SplitInfo info;
@@ -485,3 +1845,384 @@ SplitInfo BoostedTree::Impl::GetApproxSplitInfo(
   info.miss_left = best_miss_left;
   return info;
 }
+
+void BoostedTree::Impl::BuildBinMatrix() {
+  // Weighted quantile sketch over all samples, computed once before training
+  const int num_samples = XT_[0].length();
+  const int num_features = XT_.length();
+  using pair_t = std::pair<float, GradientInfo>;
+  using quantile_t = Quantile<float, GradientInfo>;
+  using summary_t = quantile_t::Summary;
+  std::vector<std::vector<float>> cuts(num_features);
+#pragma omp parallel for num_threads(param_.n_jobs)
+  for (int f = 0; f < num_features; ++f) {
+    CSRRow<float> sfeat = XT_[f];
+    const dim_t nnz = sfeat.nnz();
+    const float *values = sfeat.values();
+    std::vector<pair_t> buf;
+    buf.reserve(nnz + 1);
+    for (dim_t i = 0; i < nnz; ++i) {
+      if (!IsMissing(values[i])) buf.emplace_back(values[i], GradientInfo(1));
+    }
+    // the entries which are not stored are zero
+    if (nnz < num_samples && !param_.zero_as_missing)
+      buf.emplace_back(0, GradientInfo(num_samples - nnz));
+    if (buf.empty()) continue;
+    summary_t summary(buf);
+    int num_cuts = summary.size();
+    if (num_cuts > param_.max_bin) {
+      // the quantiles [0, 1 / max_bin, ..., 1], the maximum is not a split
+      summary = quantile_t::Prune(summary, param_.max_bin);
+      num_cuts = summary.size() - 1;
+    }
+    // the first value is the minimum, which is not a split
+    for (int i = 1; i < num_cuts; ++i) {
+      cuts[f].push_back(summary[i].value);
+    }
+  }
+  std::vector<int> cut_ptrs(num_features + 1, 0);
+  std::vector<float> cut_values;
+  for (int f = 0; f < num_features; ++f) {
+    cut_values.insert(cut_values.end(), cuts[f].begin(), cuts[f].end());
+    cut_ptrs[f + 1] = cut_values.size();
+  }
+  bins_.SetCuts(cut_ptrs, cut_values);
+  // (sample id, bin) of the entries which are not in the default bins
+  std::vector<std::vector<std::pair<int, int>>> entries(num_features);
+#pragma omp parallel for num_threads(param_.n_jobs)
+  for (int f = 0; f < num_features; ++f) {
+    auto get_bin = [&](const float value) {
+      return IsMissing(value) ? bins_.MissingBin(f) : bins_.ValueToBin(f, value);
+    };
+    // the bin of the entries which are not stored
+    const int default_bin = get_bin(0);
+    bins_.SetDefaultBin(f, default_bin);
+    CSRRow<float> sfeat = XT_[f];
+    const dim_t nnz = sfeat.nnz();
+    const dim_t *indices = sfeat.indices();
+    const float *values = sfeat.values();
+    for (dim_t i = 0; i < nnz; ++i) {
+      const int bin = get_bin(values[i]);
+      if (bin != default_bin) entries[f].emplace_back(indices[i], bin);
+    }
+  }
+  std::vector<std::vector<int>> columns;
+  if (param_.enable_bundle) {
+    columns = BundleFeatures(entries);
+  } else {
+    for (int f = 0; f < num_features; ++f) columns.push_back({f});
+  }
+  // the entries of a column with the column-local bins, sorted by sample id
+  const int num_columns = columns.size();
+  std::vector<std::vector<std::pair<int, int>>> column_entries(num_columns);
+  std::vector<size_t> nnz(num_columns);
+#pragma omp parallel for num_threads(param_.n_jobs)
+  for (int c = 0; c < num_columns; ++c) {
+    std::vector<std::pair<int, int>> &column = column_entries[c];
+    if (columns[c].size() == 1) {
+      column = std::move(entries[columns[c][0]]);
+    } else {
+      int offset = 0;
+      for (int f : columns[c]) {
+        for (const auto &e : entries[f]) {
+          column.emplace_back(e.first, offset + e.second);
+        }
+        offset += bins_.FeatureNumBins(f);
+        std::vector<std::pair<int, int>>().swap(entries[f]);
+      }
+      // a conflicting sample keeps the bin of the first feature
+      std::stable_sort(column.begin(), column.end(),
+                       [](const std::pair<int, int> &a,
+                          const std::pair<int, int> &b) {
+                         return a.first < b.first;
+                       });
+      column.erase(std::unique(column.begin(), column.end(),
+                               [](const std::pair<int, int> &a,
+                                  const std::pair<int, int> &b) {
+                                 return a.first == b.first;
+                               }),
+                   column.end());
+    }
+    nnz[c] = column.size();
+  }
+  bins_.SetColumns(num_samples, columns, nnz);
+  int num_dense_columns = 0;
+#pragma omp parallel for num_threads(param_.n_jobs) \
+    reduction(+ : num_dense_columns)
+  for (int c = 0; c < num_columns; ++c) {
+    const std::vector<std::pair<int, int>> &column = column_entries[c];
+    const size_t num_entries = column.size();
+    if (bins_.IsDense(c)) {
+      const int default_bin = bins_.DefaultBin(columns[c][0]);
+      for (int r = 0; r < num_samples; ++r) bins_.SetBin(c, r, default_bin);
+      for (const auto &e : column) bins_.SetBin(c, e.first, e.second);
+      ++num_dense_columns;
+    } else {
+      for (size_t k = 0; k < num_entries; ++k) {
+        bins_.SetRow(c, k, column[k].first);
+        bins_.SetBin(c, k, column[k].second);
+      }
+    }
+  }
+  LOG(INFO) << "Build bin matrix: " << bins_.NumBins() << " bins, "
+            << (bins_.IsCompact() ? "uint8" : "uint16") << ", "
+            << num_dense_columns << " dense columns, "
+            << num_columns - num_dense_columns << " sparse columns";
+}
+
+std::vector<std::vector<int>> BoostedTree::Impl::BundleFeatures(
+    const std::vector<std::vector<std::pair<int, int>>> &entries) {
+  // Exclusive Feature Bundling (LightGBM)
+  const int num_samples = XT_[0].length();
+  const int num_features = entries.size();
+  // only the sparse features are bundled
+  const float max_sparse_rate = 0.2;
+  const size_t max_conflicts = param_.max_conflict_rate * num_samples;
+  // a bundle is searched in the latest bundles
+  const int max_search_bundles = 100;
+  int max_feature_bins = 0;
+  for (int f = 0; f < num_features; ++f) {
+    max_feature_bins = std::max(max_feature_bins, bins_.FeatureNumBins(f));
+  }
+  // keep uint8_t bins if possible
+  const int max_bundle_bins = max_feature_bins <= 256 ? 256 : 65536;
+
+  std::vector<std::vector<int>> columns;
+  std::vector<int> sparse_features;
+  for (int f = 0; f < num_features; ++f) {
+    if (entries[f].size() <= max_sparse_rate * num_samples)
+      sparse_features.push_back(f);
+    else
+      columns.push_back({f});
+  }
+  // the features with more entries are bundled first
+  std::stable_sort(sparse_features.begin(), sparse_features.end(),
+                   [&](const int a, const int b) {
+                     return entries[a].size() > entries[b].size();
+                   });
+  struct Bundle {
+    std::vector<int> features;
+    int num_bins = 0;
+    size_t num_conflicts = 0;
+    // the samples which are stored in the bundle
+    std::vector<bool> marks;
+  };
+  std::vector<Bundle> bundles;
+  for (int f : sparse_features) {
+    const int num_bins = bins_.FeatureNumBins(f);
+    int best = -1;
+    size_t best_conflicts = 0;
+    const int first = std::max(0, int(bundles.size()) - max_search_bundles);
+    for (int b = first; b < int(bundles.size()); ++b) {
+      Bundle &bundle = bundles[b];
+      if (bundle.num_bins + num_bins > max_bundle_bins) continue;
+      size_t num_conflicts = bundle.num_conflicts;
+      for (const auto &e : entries[f]) {
+        if (bundle.marks[e.first] && ++num_conflicts > max_conflicts) break;
+      }
+      if (num_conflicts <= max_conflicts) {
+        best = b;
+        best_conflicts = num_conflicts;
+        break;
+      }
+    }
+    if (best == -1) {
+      best = bundles.size();
+      bundles.emplace_back();
+      bundles[best].marks.resize(num_samples);
+      // the bundles which are not searched any more don't need the marks
+      if (best >= max_search_bundles) {
+        std::vector<bool>().swap(bundles[best - max_search_bundles].marks);
+      }
+    }
+    Bundle &bundle = bundles[best];
+    bundle.features.push_back(f);
+    bundle.num_bins += num_bins;
+    bundle.num_conflicts = best_conflicts;
+    for (const auto &e : entries[f]) bundle.marks[e.first] = true;
+  }
+  int num_bundled_features = 0, num_bundles = 0;
+  for (Bundle &bundle : bundles) {
+    if (bundle.features.size() > 1) {
+      num_bundled_features += bundle.features.size();
+      ++num_bundles;
+    }
+    columns.push_back(std::move(bundle.features));
+  }
+  LOG(INFO) << "Bundle " << num_bundled_features << " sparse features into "
+            << num_bundles << " bundles";
+  return columns;
+}
+
+void BoostedTree::Impl::BuildHists(std::vector<HistTask> *tasks) {
+  const int num_tasks = tasks->size();
+  // positions_[i] == nid for the samples of the node
+#pragma omp parallel for num_threads(param_.n_jobs)
+  for (int t = 0; t < num_tasks; ++t) {
+    HistTask &task = (*tasks)[t];
+    GradientInfo total;
+    for (int i : task.sample_ids) {
+      positions_[i] = task.nid;
+      total += gpair_[i];
+    }
+    task.total = total;
+  }
+  // the columns of the features of the nodes
+  std::vector<int> column_marks(bins_.NumColumns(), -1);
+  for (int t = 0; t < num_tasks; ++t) {
+    HistTask &task = (*tasks)[t];
+    task.column_ids.clear();
+    for (int f : *task.feature_ids) {
+      const int c = bins_.FeatureColumn(f);
+      if (column_marks[c] == t) continue;
+      column_marks[c] = t;
+      task.column_ids.push_back(c);
+    }
+  }
+  // (node, column) pairs, offsets[t]: the first pair of the t-th task
+  std::vector<size_t> offsets(num_tasks + 1, 0);
+  for (int t = 0; t < num_tasks; ++t) {
+    offsets[t + 1] = offsets[t] + (*tasks)[t].column_ids.size();
+  }
+  const size_t num_pairs = offsets.back();
+#pragma omp parallel for num_threads(param_.n_jobs) schedule(dynamic)
+  for (size_t k = 0; k < num_pairs; ++k) {
+    const int t = std::upper_bound(offsets.begin(), offsets.end(), k) -
+                  offsets.begin() - 1;
+    const HistTask &task = (*tasks)[t];
+    const int column_id = task.column_ids[k - offsets[t]];
+    const int bin_begin = bins_.ColumnBinBegin(column_id);
+    HistBin *column_hist = task.hist + bin_begin;
+    if (bins_.IsCompact())
+      BuildColumnHist<uint8_t>(task.nid, task.sample_ids, task.total,
+                               column_id, column_hist);
+    else
+      BuildColumnHist<uint16_t>(task.nid, task.sample_ids, task.total,
+                                column_id, column_hist);
+    if (task.sibling != nullptr) {
+      // sibling = parent - node
+      const int bin_end = bin_begin + bins_.ColumnNumBins(column_id);
+      for (int b = bin_begin; b < bin_end; ++b) {
+        task.sibling[b].gradient =
+            task.parent[b].gradient - task.hist[b].gradient;
+        task.sibling[b].hessian = task.parent[b].hessian - task.hist[b].hessian;
+        task.sibling[b].count = task.parent[b].count - task.hist[b].count;
+      }
+    }
+  }
+}
+
+template <typename BinType>
+void BoostedTree::Impl::BuildColumnHist(const int nid,
+                                        const RowSlice &sample_ids,
+                                        const GradientInfo &total,
+                                        int column_id, HistBin *hist) {
+  const BinType *column = bins_.Column<BinType>(column_id);
+  std::fill(hist, hist + bins_.ColumnNumBins(column_id), HistBin());
+  if (bins_.IsDense(column_id)) {
+    for (int i : sample_ids) {
+      hist[column[i]] += gpair_[i];
+    }
+    return;
+  }
+  // sparsity-aware: only the stored entries are visited,
+  // the other samples of the node are in the default bins
+  const size_t nnz = bins_.NumStored(column_id);
+  const int *rows = bins_.Rows(column_id);
+  const size_t num_samples = sample_ids.size();
+  if (nnz <= num_samples * std::max(1, int(std::log2(nnz + 1)))) {
+    // scan the stored entries of the column
+    for (size_t k = 0; k < nnz; ++k) {
+      if (positions_[rows[k]] != nid) continue;
+      hist[column[k]] += gpair_[rows[k]];
+    }
+  } else {
+    // search the samples of a small node in the stored entries
+    const int *rows_end = rows + nnz;
+    for (int i : sample_ids) {
+      const int *p = std::lower_bound(rows, rows_end, i);
+      if (p == rows_end || *p != i) continue;
+      hist[column[p - rows]] += gpair_[i];
+    }
+  }
+  // default bin = node total - the other bins of the feature
+  HistBin *feature_hist = hist;
+  for (int f : bins_.ColumnFeatures(column_id)) {
+    const int num_bins = bins_.FeatureNumBins(f);
+    const int default_bin = bins_.DefaultBin(f);
+    HistBin stored;
+    for (int b = 0; b < num_bins; ++b) {
+      if (b == default_bin) continue;
+      stored.gradient += feature_hist[b].gradient;
+      stored.hessian += feature_hist[b].hessian;
+      stored.count += feature_hist[b].count;
+    }
+    HistBin &default_hist = feature_hist[default_bin];
+    default_hist.gradient = total.gradient - stored.gradient;
+    default_hist.hessian = total.hessian - stored.hessian;
+    default_hist.count = static_cast<int>(num_samples) - stored.count;
+    feature_hist += num_bins;
+  }
+}
+
+SplitInfo BoostedTree::Impl::GetHistSplitInfo(int feature_id,
+                                              const HistBin *hist,
+                                              const float G_sum,
+                                              const float H_sum) {
+  // Enumerate the boundaries between the bins of a histogram, the empty bins
+  // are skipped by their counts since a derived bin may be nonzero
+  const int missing_bin = bins_.MissingBin(feature_id);
+  const float G_missing = hist[missing_bin].gradient;
+  const float H_missing = hist[missing_bin].hessian;
+  const bool exist_missing = hist[missing_bin].count > 0;
+  float G_L = 0, H_L = 0;
+  float best_gain = FLT_MIN;
+  int best_bin = -1;
+  bool best_miss_left;
+  int num_nonempty_bins = 0;
+  for (int b = 0; b < missing_bin; ++b) {
+    if (hist[b].count == 0) continue;
+    if (num_nonempty_bins++ == 0) {
+      // no sample is on the left side of the first non-empty bin
+      G_L += hist[b].gradient;
+      H_L += hist[b].hessian;
+      continue;
+    }
+    {
+      // try enumerate missing value goto right
+      float G_R = G_sum - G_L;
+      float H_R = H_sum - H_L;
+      float gain = GetGain(G_L, H_L) + GetGain(G_R, H_R);
+      if (gain > best_gain) {
+        best_gain = gain;
+        best_bin = b;
+        best_miss_left = false;
+      }
+    }
+    if (exist_missing) {
+      // try enumerate missing value goto left
+      float G_L2 = G_L + G_missing;
+      float H_L2 = H_L + H_missing;
+      float G_R2 = G_sum - G_L2;
+      float H_R2 = H_sum - H_L2;
+      float gain = GetGain(G_L2, H_L2) + GetGain(G_R2, H_R2);
+      if (gain > best_gain) {
+        best_gain = gain;
+        best_bin = b;
+        best_miss_left = true;
+      }
+    }
+    G_L += hist[b].gradient;
+    H_L += hist[b].hessian;
+  }
+  SplitInfo info;
+  if (best_bin == -1) {
+    info.feature_id = -1;
+    return info;
+  }
+  info.feature_id = feature_id;
+  info.split = bins_.SplitValue(feature_id, best_bin);
+  info.gain = best_gain;
+  info.miss_left = best_miss_left;
+  return info;
+}
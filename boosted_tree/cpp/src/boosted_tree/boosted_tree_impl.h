@@ -3,17 +3,31 @@
 #include <boosted_tree/array.h>
 #include <boosted_tree/boosted_tree.h>
 #include <boosted_tree/csr_matrix.h>
+#include <boosted_tree/gradient_info.h>
 #include <boosted_tree/objective.h>
 #include <boosted_tree/vec.h>
 
 #include <array>
-#include <mutex>
+#include <map>
+#include <memory>
 #include <numeric>
 #include <queue>
+#include <random>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "./block_predictor.h"
+#include "./column_block.h"
+#include "./compact_model.h"
+#include "./histogram.h"
+#include "./mapped_file.h"
+#include "./model_format.h"
+#include "./model_import.h"
+#include "./quick_scorer.h"
+#include "./row_partitioner.h"
+
 struct Node {
   /*
    * Inner Node
@@ -25,13 +39,17 @@ struct Node {
    * Leaf
    *   is_leaf = true
    *   predict: value
+   *
+   * The children are adjacent, right = left + 1.
    */
-  int left, right;
+  int left;
   int feature_id;
   float value;
   bool is_leaf;
   bool miss_left;
+  inline int right() const { return left + 1; }
 };
+static_assert(sizeof(Node) == 16, "Node should be packed into 16 bytes");
 
 struct SplitInfo {
   int feature_id;
@@ -40,48 +58,141 @@ struct SplitInfo {
   bool miss_left;
 };
 
-struct GradientInfo {
-  float gradient, hessian;
-  GradientInfo() : gradient(0), hessian(0){};
-  GradientInfo(float value) : gradient(value), hessian(value){};
-  GradientInfo(float g, float h) : gradient(g), hessian(h){};
-  GradientInfo &operator+=(const GradientInfo &b) {
-    gradient += b.gradient;
-    hessian += b.hessian;
-    return *this;
-  }
-  GradientInfo operator+(const GradientInfo &b) const {
-    GradientInfo info(gradient + b.gradient, hessian + b.hessian);
-    return info;
-  }
-  bool operator<(const GradientInfo &b) const { return hessian < b.hessian; }
-  operator float() const { return hessian; }
+// a node to be expanded
+struct ExpandEntry {
+  int nid;
+  // the samples of the node are [begin, end) of the index buffer
+  size_t begin, end;
+  int depth;
+  // the candidate features, then the valid features after evaluation
+  std::vector<int> feature_ids;
+  float G_sum, H_sum;
+  // info.feature_id == -1: no valid split
+  SplitInfo info;
+  // the loss reduction of the split
+  float loss_chg;
+};
+
+// the histogram of a node to be built
+struct HistTask {
+  int nid;
+  RowSlice sample_ids;
+  const std::vector<int> *feature_ids;
+  // the columns of the features in the bin matrix
+  std::vector<int> column_ids;
+  GradientInfo total;
+  HistBin *hist;
+  // sibling = parent - hist if sibling != nullptr
+  const HistBin *parent = nullptr;
+  HistBin *sibling = nullptr;
 };
 
 class BoostedTree::Impl {
  public:
   Impl(const BoostedTreeParam &);
-  void train(const CSRMatrix<float> &X, const Vec<float> &Y);
+  void train(const CSRMatrix<float> &X, const Vec<float> &Y,
+             const std::vector<EvalData> &eval_set);
   Vec<float> predict(const CSRMatrix<float> &X) const;
+  int num_outputs() const;
+  Vec<float> predict(const CSRMatrix<float> &X, const int tree_begin,
+                     const int tree_end) const;
+  Vec<float> predict_staged(const CSRMatrix<float> &X, int tree_end);
+  void clear_margin_cache();
+  Vec<float> predict_label(const CSRMatrix<float> &X,
+                           const float threshold) const;
   float predict_one(const CSRRow<float> &X) const;
   std::string str() const;
+  std::string export_cpp() const;
+  void save_model(const std::string &fname) const;
+  void load_model(const std::string &fname);
+  std::string save_raw() const;
+  void load_raw(const std::string &buf);
+  void load_xgboost_model(const std::string &fname);
+  void load_lightgbm_model(const std::string &fname);
 
  private:
+  // load a model of the binary format, the nodes of a mapped file are not
+  // copied
+  void LoadModel(const char *data, const size_t size,
+                 std::shared_ptr<MappedFile> file);
+  void ImportModel(const ImportedModel &model);
+  // prepare the predictor after the trees are changed
+  void BuildPredictor();
+  // the nodes of the model, nodes_ or the nodes of a mapped model file
+  inline const Node *ModelNodes() const {
+    return mapped_file_ ? mapped_nodes_ : nodes_.data();
+  }
+  inline size_t NumModelNodes() const {
+    return mapped_file_ ? num_mapped_nodes_ : nodes_.size();
+  }
+  // out[c] = the base margin + the values of the trees of the class c
+  void PredictMargins(const CSRRow<float> &X, float *out) const;
+  // the predictions of the row-major margins
+  Vec<float> Transform(Vec<float> margins) const;
+  // add the values of the trees [tree_begin, tree_end) into the row-major
+  // margins
+  void AddTreeMargins(const CSRMatrix<float> &X, const int tree_begin,
+                      const int tree_end, float *margins) const;
+  // the margins of the blocks of rows through the tiles of trees
+  Vec<float> PredictBlocks(const CSRMatrix<float> &X) const;
   float predict_one_in_a_tree(const CSRRow<float> &X, int root) const;
-  int GetNewNodeID();
-  int CreateNode(Vec<float> &integrals, const std::vector<int> &sample_ids,
-                 const std::vector<int> &feature_ids, const int depth);
+  // x is the dense row, whose missing entries are zeros like CSRRow
+  float predict_one_in_a_tree(const float *x, int root) const;
+  // the margins of every class before the new trees, given by the base
+  // margin and the existing trees
+  std::vector<Vec<float>> InitMargins(const CSRMatrix<float> &X) const;
+  // integrals are the margins of every class
+  void ComputeGradients(const std::vector<Vec<float>> &integrals);
+  // gpair_ = the gradients of the class k
+  void SelectClassGradients(const int k);
+  float ComputeLoss(const std::vector<Vec<float>> &integrals,
+                    const Vec<float> &Y) const;
+  // sample the rows of a tree, return the number of the sampled rows
+  int SampleRows(const int iter);
+  // allocate adjacent nodes, return the id of the first one
+  int AllocNodes(const int num_nodes);
+  void BuildTree(const int root, Vec<float> &integrals,
+                 const size_t num_samples, const std::vector<int> &feature_ids);
+  // find the best splits of the nodes
+  void EvaluateSplits(ExpandEntry *entries, const int num_entries);
+  // split the nodes or make them leaves, append the children
+  void ApplySplits(const ExpandEntry *entries, const int num_entries,
+                   std::vector<ExpandEntry> *children, Vec<float> &integrals);
+  void MakeLeaf(const ExpandEntry &entry, Vec<float> &integrals);
+  // go_left_[i] for the samples of a node split by info, the sample ids are
+  // sorted as the column of the feature
+  void GatherGoLeft(const SplitInfo &info, const RowSlice &sample_ids,
+                    const int n_jobs);
+  // column subsampling, the sampled features are sorted
+  std::vector<int> SampleFeatures(const std::vector<int> &feature_ids,
+                                  const float rate);
+  const std::vector<int> &LevelFeatures(const int depth);
+  inline bool IsMissing(const float value) const;
   inline float GetGain(float G, float H) const;
-  SplitInfo GetExactSplitInfo(const std::vector<int> &sample_ids,
-                              int feature_id, const Vec<float> &gradients,
-                              const float G_sum, const Vec<float> &hessians,
-                              const float H_sum);
+  SplitInfo GetExactSplitInfo(const RowSlice &sample_ids, int feature_id,
+                              const float G_sum, const float H_sum);
 
-  SplitInfo GetApproxSplitInfo(const std::vector<int> &sample_ids,
-                               int feature_id, const Vec<float> &gradients,
-                               const float G_sum, const Vec<float> &hessians,
+  SplitInfo GetSortedSplitInfo(const int nid, const size_t num_samples,
+                               int feature_id, const float G_sum,
                                const float H_sum);
 
+  SplitInfo GetApproxSplitInfo(const int nid, const RowSlice &sample_ids,
+                               int feature_id, const float G_sum,
+                               const float H_sum);
+
+  void BuildBinMatrix();
+  // entries[f]: (sample id, bin) of the entries not in the default bin,
+  // return the features of the columns
+  std::vector<std::vector<int>> BundleFeatures(
+      const std::vector<std::vector<std::pair<int, int>>> &entries);
+  void BuildHists(std::vector<HistTask> *tasks);
+  template <typename BinType>
+  void BuildColumnHist(const int nid, const RowSlice &sample_ids,
+                       const GradientInfo &total, int column_id,
+                       HistBin *hist);
+  SplitInfo GetHistSplitInfo(int feature_id, const HistBin *hist,
+                             const float G_sum, const float H_sum);
+
  private:
   template <typename DType, typename IType>
   Vec<DType> ReorderVec(const Vec<DType> &data, const std::vector<IType> &inds);
@@ -90,9 +201,50 @@ class BoostedTree::Impl {
   BoostedTreeParam param_;
   std::vector<int> trees;
   Objective<float> *objective;
-  std::vector<Node *> nodes_;
-  std::queue<int> free_nodes_queue_;
-  std::mutex nodes_alloc_mtx_;
+  // the nodes of a tree are contiguous, and its root is the first one
+  std::vector<Node> nodes_;
+  std::shared_ptr<MappedFile> mapped_file_;
+  const Node *mapped_nodes_ = nullptr;
+  size_t num_mapped_nodes_ = 0;
+  int num_features_ = 0;
+  // the margin before the first tree, e.g. base_score of XGBoost
+  float base_margin_ = 0;
+  // built after training if predictor is "quickscorer"
+  QuickScorer quick_scorer_;
+  // built after training if predictor is "compact"
+  CompactModel compact_model_;
+  // the minimum and the maximum leaf values of every tree
+  std::vector<std::pair<float, float>> leaf_ranges_;
+  // the staged margins of a matrix, keyed by its storage
+  struct MarginCache {
+    int num_trees = 0;
+    dim_t nnz = 0;
+    Vec<float> margins;
+  };
+  std::map<std::weak_ptr<const CSRChunk<float>>, MarginCache,
+           std::owner_less<std::weak_ptr<const CSRChunk<float>>>>
+      margin_caches_;
   CSRMatrix<float> XT_;
   Vec<float> Y_;
+  std::vector<GradientInfo> gpair_;
+  // multi-class: the row-major margins and gradients of the classes
+  std::vector<float> margins_;
+  std::vector<GradientInfo> class_gpair_;
+  // the rows sampled for the current tree
+  std::vector<char> row_sampled_;
+  std::vector<int> sampled_rows_;
+  ColumnBlock columns_;
+  // the node id of every sample, used to scan the sparse columns
+  std::vector<int> positions_;
+  // whether a sample of a node being split goes to the left child
+  std::vector<char> go_left_;
+  RowPartitioner partitioner_;
+  std::mt19937 rng_;
+  // the features sampled for the current tree and its levels
+  std::vector<int> tree_feature_ids_;
+  std::vector<std::vector<int>> level_feature_ids_;
+  // the split candidates of the (node, feature) pairs in EvaluateSplits
+  std::vector<SplitInfo> split_infos_;
+  BinMatrix bins_;
+  HistogramPool<HistBin> hist_pool_;
 };
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <boosted_tree/csr_matrix.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/*
+ * Pre-sorted columns used by tree_method = "exact"
+ *
+ * Column f stores the stored non-missing values of feature f with their
+ * sample ids, sorted by value, and the ids of the samples whose stored value
+ * is missing. The samples which are not stored in XT are not in the column,
+ * they are handled as a default bucket by the split finder.
+ *   entries: [entry_ptrs[f], entry_ptrs[f + 1])
+ *   missing samples: [missing_ptrs[f], missing_ptrs[f + 1])
+ */
+class ColumnBlock {
+ public:
+  struct Entry {
+    float value;
+    int index;
+    bool operator<(const Entry &b) const {
+      return value < b.value || (value == b.value && index < b.index);
+    }
+  };
+
+ public:
+  // XT: (num_features, num_samples)
+  void Reset(const CSRMatrix<float> &XT, bool zero_as_missing, int n_jobs) {
+    const int num_features = XT.length();
+    std::vector<std::vector<Entry>> columns(num_features);
+    std::vector<std::vector<int>> missing(num_features);
+#pragma omp parallel for num_threads(n_jobs)
+    for (int f = 0; f < num_features; ++f) {
+      CSRRow<float> sfeat = XT[f];
+      const dim_t nnz = sfeat.nnz();
+      const dim_t *indices = sfeat.indices();
+      const float *values = sfeat.values();
+      std::vector<Entry> &column = columns[f];
+      column.reserve(nnz);
+      for (dim_t k = 0; k < nnz; ++k) {
+        if (std::isnan(values[k]) || (zero_as_missing && values[k] == 0))
+          missing[f].push_back(indices[k]);
+        else
+          column.push_back(Entry{values[k], int(indices[k])});
+      }
+      std::sort(column.begin(), column.end());
+    }
+    entry_ptrs_.resize(num_features + 1);
+    missing_ptrs_.resize(num_features + 1);
+    entry_ptrs_[0] = missing_ptrs_[0] = 0;
+    for (int f = 0; f < num_features; ++f) {
+      entry_ptrs_[f + 1] = entry_ptrs_[f] + columns[f].size();
+      missing_ptrs_[f + 1] = missing_ptrs_[f] + missing[f].size();
+    }
+    entries_.resize(entry_ptrs_.back());
+    missing_.resize(missing_ptrs_.back());
+#pragma omp parallel for num_threads(n_jobs)
+    for (int f = 0; f < num_features; ++f) {
+      std::copy(columns[f].begin(), columns[f].end(),
+                entries_.begin() + entry_ptrs_[f]);
+      std::copy(missing[f].begin(), missing[f].end(),
+                missing_.begin() + missing_ptrs_[f]);
+    }
+  }
+
+  inline const Entry *EntryBegin(int f) const {
+    return entries_.data() + entry_ptrs_[f];
+  }
+  inline const Entry *EntryEnd(int f) const {
+    return entries_.data() + entry_ptrs_[f + 1];
+  }
+  inline size_t NumEntries(int f) const {
+    return entry_ptrs_[f + 1] - entry_ptrs_[f];
+  }
+  inline const int *MissingBegin(int f) const {
+    return missing_.data() + missing_ptrs_[f];
+  }
+  inline const int *MissingEnd(int f) const {
+    return missing_.data() + missing_ptrs_[f + 1];
+  }
+
+ private:
+  std::vector<Entry> entries_;
+  std::vector<size_t> entry_ptrs_;
+  std::vector<int> missing_;
+  std::vector<size_t> missing_ptrs_;
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * The compact model for inference
+ *
+ * The thresholds of a feature are replaced by their indices in the sorted
+ * unique thresholds of the feature, and a row is binned once into the number
+ * of thresholds <= x, so that x < threshold[j] iff bin(x) <= j.
+ * An inner node takes 8 bytes, and the leaves are stored in another array:
+ *   feature: the feature id, the highest bit is miss_left
+ *   bin: the index of the threshold
+ *   left, right: the index of the child in its tree, the highest bit means a
+ *                leaf
+ * The trees which don't fit in the 15-bit indices, or use a feature with too
+ * many thresholds, are traversed.
+ */
+class CompactModel {
+ public:
+  static constexpr uint16_t kLeafBit = 0x8000;
+  static constexpr uint16_t kMissLeftBit = 0x8000;
+  static constexpr uint16_t kMissingBin = 0xFFFF;
+  // the bins of the values are in [0, kMaxThresholds]
+  static constexpr int kMaxThresholds = 0xFFFE;
+
+  struct CompactNode {
+    uint16_t feature;
+    uint16_t bin;
+    uint16_t left, right;
+  };
+
+ public:
+  template <typename NodeT>
+  void Build(const NodeT *nodes, const std::vector<int> &trees,
+             const int num_features) {
+    tree_ids_.clear();
+    fallback_trees_.clear();
+    roots_.clear();
+    node_offsets_.clear();
+    leaf_offsets_.clear();
+    nodes_.clear();
+    leaves_.clear();
+    features_.clear();
+    thr_ptrs_.assign(num_features + 1, 0);
+    thresholds_.clear();
+    // the sorted unique thresholds of every feature
+    std::vector<std::vector<float>> thresholds(num_features);
+    for (int root : trees) {
+      CollectThresholds(nodes, root, &thresholds);
+    }
+    for (int f = 0; f < num_features; ++f) {
+      std::vector<float> &thr = thresholds[f];
+      std::sort(thr.begin(), thr.end());
+      thr.erase(std::unique(thr.begin(), thr.end()), thr.end());
+      if (!thr.empty() && static_cast<int>(thr.size()) <= kMaxThresholds &&
+          f < kMissLeftBit) {
+        features_.push_back(f);
+      }
+    }
+    std::vector<char> binned(num_features, 0);
+    for (int f : features_) {
+      binned[f] = 1;
+      thresholds_.insert(thresholds_.end(), thresholds[f].begin(),
+                         thresholds[f].end());
+      thr_ptrs_[f + 1] = thresholds[f].size();
+    }
+    for (int f = 0; f < num_features; ++f) thr_ptrs_[f + 1] += thr_ptrs_[f];
+
+    for (int t = 0; t < static_cast<int>(trees.size()); ++t) {
+      int num_inner = 0, num_leaves = 0;
+      if (!Fits(nodes, trees[t], binned, &num_inner, &num_leaves) ||
+          num_inner > kLeafBit || num_leaves > kLeafBit) {
+        fallback_trees_.push_back(t);
+        continue;
+      }
+      tree_ids_.push_back(t);
+      node_offsets_.push_back(nodes_.size());
+      leaf_offsets_.push_back(leaves_.size());
+      // the inner nodes in preorder, a child is written into its parent
+      // nodes_[parent] when the child is visited
+      const size_t node_offset = nodes_.size();
+      const size_t leaf_offset = leaves_.size();
+      struct Item {
+        int nid;
+        int parent;  // -1: the root
+        bool is_right;
+      };
+      std::vector<Item> stk{{trees[t], -1, false}};
+      uint16_t root = 0;
+      while (!stk.empty()) {
+        const Item item = stk.back();
+        stk.pop_back();
+        const NodeT &node = nodes[item.nid];
+        uint16_t index;
+        if (node.is_leaf) {
+          index = kLeafBit | (leaves_.size() - leaf_offset);
+          leaves_.push_back(node.value);
+        } else {
+          index = nodes_.size() - node_offset;
+          const int f = node.feature_id;
+          const float *thr = thresholds_.data() + thr_ptrs_[f];
+          const float *thr_end = thresholds_.data() + thr_ptrs_[f + 1];
+          CompactNode cnode;
+          cnode.feature = f | (node.miss_left ? kMissLeftBit : 0);
+          cnode.bin = std::lower_bound(thr, thr_end, node.value) - thr;
+          cnode.left = cnode.right = 0;
+          const int parent = nodes_.size();
+          nodes_.push_back(cnode);
+          stk.push_back({node.right(), parent, true});
+          stk.push_back({node.left, parent, false});
+        }
+        if (item.parent < 0) {
+          root = index;
+        } else if (item.is_right) {
+          nodes_[item.parent].right = index;
+        } else {
+          nodes_[item.parent].left = index;
+        }
+      }
+      roots_.push_back(root);
+    }
+  }
+
+  /*
+   * x is a dense row, write the bins of the binned features into bins, whose
+   * size is num_features
+   */
+  template <typename MissingFn>
+  void Bin(const float *x, MissingFn is_missing, uint16_t *bins) const {
+    for (int f : features_) {
+      const float v = x[f];
+      if (is_missing(v)) {
+        bins[f] = kMissingBin;
+        continue;
+      }
+      const float *thr = thresholds_.data() + thr_ptrs_[f];
+      const float *end = thresholds_.data() + thr_ptrs_[f + 1];
+      bins[f] = std::upper_bound(thr, end, v) - thr;
+    }
+  }
+
+  // write the predictions of the trees into values[t] except for the
+  // fallback trees
+  void Predict(const uint16_t *bins, float *values) const {
+    for (size_t s = 0; s < tree_ids_.size(); ++s) {
+      const CompactNode *tree = nodes_.data() + node_offsets_[s];
+      uint16_t c = roots_[s];
+      while (!(c & kLeafBit)) {
+        const CompactNode &node = tree[c];
+        const uint16_t b = bins[node.feature & ~kMissLeftBit];
+        const bool is_left =
+            b == kMissingBin ? (node.feature & kMissLeftBit) : b <= node.bin;
+        c = is_left ? node.left : node.right;
+      }
+      values[tree_ids_[s]] = leaves_[leaf_offsets_[s] + (c & ~kLeafBit)];
+    }
+  }
+
+  // the trees which aren't compacted, whose values are not written by Predict
+  inline const std::vector<int> &FallbackTrees() const {
+    return fallback_trees_;
+  }
+
+  // the bytes of the nodes, the leaves and the thresholds
+  size_t NumBytes() const {
+    return nodes_.size() * sizeof(CompactNode) +
+           leaves_.size() * sizeof(float) + thresholds_.size() * sizeof(float);
+  }
+
+ private:
+  template <typename NodeT>
+  static void CollectThresholds(const NodeT *nodes, const int root,
+                                std::vector<std::vector<float>> *thresholds) {
+    std::vector<int> stk{root};
+    while (!stk.empty()) {
+      const NodeT &node = nodes[stk.back()];
+      stk.pop_back();
+      if (node.is_leaf) continue;
+      if (node.feature_id < static_cast<int>(thresholds->size())) {
+        (*thresholds)[node.feature_id].push_back(node.value);
+      }
+      stk.push_back(node.left);
+      stk.push_back(node.right());
+    }
+  }
+
+  // whether the features of the tree are binned
+  template <typename NodeT>
+  static bool Fits(const NodeT *nodes, const int root,
+                   const std::vector<char> &binned, int *num_inner,
+                   int *num_leaves) {
+    std::vector<int> stk{root};
+    bool fits = true;
+    while (!stk.empty()) {
+      const NodeT &node = nodes[stk.back()];
+      stk.pop_back();
+      if (node.is_leaf) {
+        ++*num_leaves;
+        continue;
+      }
+      ++*num_inner;
+      if (node.feature_id >= static_cast<int>(binned.size()) ||
+          !binned[node.feature_id]) {
+        fits = false;
+      }
+      stk.push_back(node.left);
+      stk.push_back(node.right());
+    }
+    return fits;
+  }
+
+ private:
+  // the index of the tree in the forest of every slot
+  std::vector<int> tree_ids_;
+  std::vector<int> fallback_trees_;
+  // the root of every slot, which may be a leaf
+  std::vector<uint16_t> roots_;
+  std::vector<size_t> node_offsets_, leaf_offsets_;
+  std::vector<CompactNode> nodes_;
+  std::vector<float> leaves_;
+  // the binned features, and the thresholds of feature f are
+  // thresholds_[thr_ptrs_[f], thr_ptrs_[f + 1])
+  std::vector<int> features_;
+  std::vector<int> thr_ptrs_;
+  std::vector<float> thresholds_;
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <boosted_tree/gradient_info.h>
+#include <boosted_tree/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Quantized feature matrix used by tree_method = "hist"
+ *
+ * Feature f owns the cut values [cut_ptrs[f], cut_ptrs[f + 1]).
+ *   local bin b (value): cuts[b - 1] <= value < cuts[b]
+ *   the last local bin: missing value
+ * The features are stored in columns. A column holds a feature or a bundle of
+ * sparse features which are rarely nonzero in the same row, and owns the
+ * bins of its features in the global histogram, which are contiguous.
+ * A column stores the column-local bins, i.e. the offset of the feature in
+ * the column plus the local bin. Bins are stored in uint8_t if every column
+ * has at most 256 bins, otherwise in uint16_t.
+ * A dense column stores the bins of all samples. A sparse column stores the
+ * bins of the samples which are not in the default bins of its features,
+ * with their sample ids (sorted).
+ */
+class BinMatrix {
+ public:
+  void SetCuts(const std::vector<int> &cut_ptrs,
+               const std::vector<float> &cut_values) {
+    cut_ptrs_ = cut_ptrs;
+    cut_values_ = cut_values;
+    default_bins_.assign(NumFeatures(), 0);
+  }
+
+  /*
+   * columns[c]: the features of column c
+   * nnz[c]: the number of the stored entries of column c
+   * A column with a single feature is dense if it saves memory.
+   */
+  void SetColumns(int num_rows, const std::vector<std::vector<int>> &columns,
+                  const std::vector<size_t> &nnz) {
+    num_rows_ = num_rows;
+    columns_ = columns;
+    const int num_features = NumFeatures();
+    const int num_columns = columns_.size();
+    feature_columns_.assign(num_features, -1);
+    bin_begins_.assign(num_features, 0);
+    column_bin_ptrs_.resize(num_columns + 1);
+    column_bin_ptrs_[0] = 0;
+    int max_bins = 0;
+    for (int c = 0; c < num_columns; ++c) {
+      int num_bins = 0;
+      for (int f : columns_[c]) {
+        feature_columns_[f] = c;
+        bin_begins_[f] = column_bin_ptrs_[c] + num_bins;
+        num_bins += FeatureNumBins(f);
+      }
+      max_bins = std::max(max_bins, num_bins);
+      column_bin_ptrs_[c + 1] = column_bin_ptrs_[c] + num_bins;
+    }
+    CHECK_LE(max_bins, 65536) << "too many bins in a column";
+    compact_ = max_bins <= 256;
+    const size_t bin_size = compact_ ? sizeof(uint8_t) : sizeof(uint16_t);
+    // a sparse entry takes a sample id and a bin
+    col_ptrs_.resize(num_columns + 1);
+    row_ptrs_.resize(num_columns + 1);
+    dense_.resize(num_columns);
+    col_ptrs_[0] = row_ptrs_[0] = 0;
+    for (int c = 0; c < num_columns; ++c) {
+      const bool dense =
+          columns_[c].size() == 1 &&
+          nnz[c] * (sizeof(int) + bin_size) >= size_t(num_rows_) * bin_size;
+      dense_[c] = dense;
+      col_ptrs_[c + 1] = col_ptrs_[c] + (dense ? num_rows_ : nnz[c]);
+      row_ptrs_[c + 1] = row_ptrs_[c] + (dense ? 0 : nnz[c]);
+    }
+    rows_.resize(row_ptrs_.back());
+    bins8_.clear();
+    bins16_.clear();
+    if (compact_)
+      bins8_.resize(col_ptrs_.back());
+    else
+      bins16_.resize(col_ptrs_.back());
+  }
+
+  inline int NumFeatures() const { return int(cut_ptrs_.size()) - 1; }
+  inline int NumRows() const { return num_rows_; }
+  inline int NumBins() const { return column_bin_ptrs_.back(); }
+  inline bool IsCompact() const { return compact_; }
+  inline int FeatureBinBegin(int f) const { return bin_begins_[f]; }
+  inline int FeatureNumBins(int f) const {
+    // value bins and missing bin
+    return cut_ptrs_[f + 1] - cut_ptrs_[f] + 2;
+  }
+  inline int MissingBin(int f) const { return FeatureNumBins(f) - 1; }
+
+  int ValueToBin(int f, float value) const {
+    if (std::isnan(value)) return MissingBin(f);
+    const float *first = cut_values_.data() + cut_ptrs_[f];
+    const float *last = cut_values_.data() + cut_ptrs_[f + 1];
+    return std::upper_bound(first, last, value) - first;
+  }
+
+  // the samples whose bin is less than `bin` go to the left child
+  inline float SplitValue(int f, int bin) const {
+    DCHECK_GT(bin, 0);
+    return cut_values_[cut_ptrs_[f] + bin - 1];
+  }
+
+  // the bin of the entries which are not stored
+  inline int DefaultBin(int f) const { return default_bins_[f]; }
+  inline void SetDefaultBin(int f, int bin) { default_bins_[f] = bin; }
+
+  // the storage of column c
+  inline int NumColumns() const { return columns_.size(); }
+  inline int FeatureColumn(int f) const { return feature_columns_[f]; }
+  inline const std::vector<int> &ColumnFeatures(int c) const {
+    return columns_[c];
+  }
+  inline int ColumnBinBegin(int c) const { return column_bin_ptrs_[c]; }
+  inline int ColumnNumBins(int c) const {
+    return column_bin_ptrs_[c + 1] - column_bin_ptrs_[c];
+  }
+  inline bool IsDense(int c) const { return dense_[c]; }
+  inline size_t NumStored(int c) const {
+    return col_ptrs_[c + 1] - col_ptrs_[c];
+  }
+  // the sorted sample ids of a sparse column
+  inline const int *Rows(int c) const { return rows_.data() + row_ptrs_[c]; }
+
+  // dense: indexed by sample id, sparse: indexed by the k-th stored entry
+  template <typename BinType>
+  BinType *Column(int c);
+  template <typename BinType>
+  const BinType *Column(int c) const;
+
+  inline void SetBin(int c, size_t i, int bin) {
+    const size_t offset = col_ptrs_[c] + i;
+    if (compact_)
+      bins8_[offset] = bin;
+    else
+      bins16_[offset] = bin;
+  }
+  inline void SetRow(int c, size_t k, int row) {
+    rows_[row_ptrs_[c] + k] = row;
+  }
+
+ private:
+  int num_rows_ = 0;
+  bool compact_ = true;
+  std::vector<int> cut_ptrs_{0};
+  std::vector<float> cut_values_;
+  std::vector<int> default_bins_;
+  std::vector<std::vector<int>> columns_;
+  std::vector<int> feature_columns_;
+  std::vector<int> bin_begins_;
+  std::vector<int> column_bin_ptrs_{0};
+  std::vector<char> dense_;
+  std::vector<size_t> col_ptrs_{0};
+  std::vector<size_t> row_ptrs_{0};
+  std::vector<int> rows_;
+  std::vector<uint8_t> bins8_;
+  std::vector<uint16_t> bins16_;
+};
+
+template <>
+inline uint8_t *BinMatrix::Column<uint8_t>(int c) {
+  return bins8_.data() + col_ptrs_[c];
+}
+
+template <>
+inline const uint8_t *BinMatrix::Column<uint8_t>(int c) const {
+  return bins8_.data() + col_ptrs_[c];
+}
+
+template <>
+inline uint16_t *BinMatrix::Column<uint16_t>(int c) {
+  return bins16_.data() + col_ptrs_[c];
+}
+
+template <>
+inline const uint16_t *BinMatrix::Column<uint16_t>(int c) const {
+  return bins16_.data() + col_ptrs_[c];
+}
+
+/*
+ * A bin of a node histogram
+ * The number of samples tells an empty bin apart from a derived bin (a
+ * sibling = parent - node, or a default bin = total - the other bins), which
+ * keeps the rounding residue of the float sums when it's empty.
+ */
+struct HistBin {
+  float gradient = 0, hessian = 0;
+  int count = 0;
+  HistBin &operator+=(const GradientInfo &g) {
+    gradient += g.gradient;
+    hessian += g.hessian;
+    ++count;
+    return *this;
+  }
+};
+
+/*
+ * Cache of node histograms with a bounded number of slots
+ * The least recently used histogram is evicted when the pool is full.
+ */
+template <typename T>
+class HistogramPool {
+ public:
+  void Reset(int num_bins, int capacity) {
+    CHECK_GE(capacity, 3) << "the pool should hold a node and its children";
+    num_bins_ = num_bins;
+    capacity_ = capacity;
+    slots_.clear();
+    slot_ids_.clear();
+    timestamp_ = 0;
+  }
+
+  // return nullptr if the histogram of the node is not cached
+  T *Get(int nid) {
+    auto p = slot_ids_.find(nid);
+    if (p == slot_ids_.end()) return nullptr;
+    Slot &slot = slots_[p->second];
+    slot.timestamp = ++timestamp_;
+    return slot.hist.data();
+  }
+
+  T *Alloc(int nid) {
+    DCHECK_EQ(slot_ids_.count(nid), 0);
+    int s = -1;
+    for (int i = 0; i < slots_.size(); ++i) {
+      if (slots_[i].nid == -1) {
+        s = i;
+        break;
+      }
+    }
+    if (s == -1) {
+      if (slots_.size() < capacity_) {
+        s = slots_.size();
+        slots_.emplace_back();
+        slots_[s].hist.resize(num_bins_);
+      } else {
+        // evict the least recently used histogram
+        s = 0;
+        for (int i = 1; i < slots_.size(); ++i) {
+          if (slots_[i].timestamp < slots_[s].timestamp) s = i;
+        }
+        slot_ids_.erase(slots_[s].nid);
+      }
+    }
+    Slot &slot = slots_[s];
+    slot.nid = nid;
+    slot.timestamp = ++timestamp_;
+    slot_ids_[nid] = s;
+    return slot.hist.data();
+  }
+
+  void Release(int nid) {
+    auto p = slot_ids_.find(nid);
+    if (p == slot_ids_.end()) return;
+    slots_[p->second].nid = -1;
+    slots_[p->second].timestamp = 0;
+    slot_ids_.erase(p);
+  }
+
+ private:
+  struct Slot {
+    int nid = -1;
+    size_t timestamp = 0;
+    std::vector<T> hist;
+  };
+  int num_bins_ = 0;
+  int capacity_ = 0;
+  size_t timestamp_ = 0;
+  std::vector<Slot> slots_;
+  std::unordered_map<int, int> slot_ids_;
+};
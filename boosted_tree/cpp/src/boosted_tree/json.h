@@ -0,0 +1,208 @@
+#pragma once
+
+#include <boosted_tree/logging.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/*
+ * A minimal JSON reader for the model files of the other libraries
+ *
+ * The text of a number is kept, so that a float is parsed by strtof without
+ * rounding twice.
+ */
+class JsonValue {
+ public:
+  enum Type { kNull, kBool, kNumber, kString, kArray, kObject };
+
+ public:
+  static JsonValue Parse(const std::string &text) {
+    size_t pos = 0;
+    JsonValue value = ParseValue(text, pos);
+    SkipSpaces(text, pos);
+    CHECK_EQ(pos, text.size()) << " Unexpected JSON text";
+    return value;
+  }
+
+  inline Type type() const { return type_; }
+  inline const std::string &str() const { return str_; }
+  inline const std::vector<JsonValue> &array() const { return values_; }
+
+  bool Has(const std::string &key) const {
+    for (const std::string &k : keys_) {
+      if (k == key) return true;
+    }
+    return false;
+  }
+
+  const JsonValue &operator[](const std::string &key) const {
+    CHECK_EQ(type_, kObject) << " Not a JSON object, key: " << key;
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      if (keys_[i] == key) return values_[i];
+    }
+    LOG(FATAL) << "No key " << key << " in the JSON object";
+    return *this;
+  }
+
+  // the numbers are also accepted in strings, e.g. "5E-1"
+  float AsFloat() const { return strtof(NumberText().c_str(), nullptr); }
+  int64_t AsInt() const { return strtoll(NumberText().c_str(), nullptr, 10); }
+  bool AsBool() const {
+    if (type_ == kBool) return bool_;
+    return AsInt() != 0;
+  }
+
+ private:
+  const std::string &NumberText() const {
+    CHECK(type_ == kNumber || type_ == kString) << "Not a JSON number";
+    return str_;
+  }
+
+  static void SkipSpaces(const std::string &text, size_t &pos) {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\n' ||
+                                 text[pos] == '\r' || text[pos] == '\t')) {
+      ++pos;
+    }
+  }
+
+  static void Expect(const std::string &text, size_t &pos, const char c) {
+    SkipSpaces(text, pos);
+    CHECK(pos < text.size() && text[pos] == c)
+        << "Expect '" << c << "' at " << pos << " in the JSON text";
+    ++pos;
+  }
+
+  static JsonValue ParseValue(const std::string &text, size_t &pos) {
+    SkipSpaces(text, pos);
+    CHECK_LT(pos, text.size()) << " Unexpected end of the JSON text";
+    JsonValue value;
+    const char c = text[pos];
+    if (c == '{') {
+      value.type_ = kObject;
+      ++pos;
+      SkipSpaces(text, pos);
+      if (pos < text.size() && text[pos] == '}') {
+        ++pos;
+        return value;
+      }
+      while (1) {
+        SkipSpaces(text, pos);
+        value.keys_.push_back(ParseString(text, pos));
+        Expect(text, pos, ':');
+        value.values_.push_back(ParseValue(text, pos));
+        SkipSpaces(text, pos);
+        if (pos < text.size() && text[pos] == ',') {
+          ++pos;
+          continue;
+        }
+        Expect(text, pos, '}');
+        return value;
+      }
+    }
+    if (c == '[') {
+      value.type_ = kArray;
+      ++pos;
+      SkipSpaces(text, pos);
+      if (pos < text.size() && text[pos] == ']') {
+        ++pos;
+        return value;
+      }
+      while (1) {
+        value.values_.push_back(ParseValue(text, pos));
+        SkipSpaces(text, pos);
+        if (pos < text.size() && text[pos] == ',') {
+          ++pos;
+          continue;
+        }
+        Expect(text, pos, ']');
+        return value;
+      }
+    }
+    if (c == '"') {
+      value.type_ = kString;
+      value.str_ = ParseString(text, pos);
+      return value;
+    }
+    if (text.compare(pos, 4, "true") == 0 ||
+        text.compare(pos, 5, "false") == 0) {
+      value.type_ = kBool;
+      value.bool_ = c == 't';
+      pos += value.bool_ ? 4 : 5;
+      return value;
+    }
+    if (text.compare(pos, 4, "null") == 0) {
+      pos += 4;
+      return value;
+    }
+    const size_t begin = pos;
+    const std::string number_chars = "+-.0123456789eE";
+    while (pos < text.size() &&
+           number_chars.find(text[pos]) != std::string::npos) {
+      ++pos;
+    }
+    CHECK_LT(begin, pos) << " Unexpected JSON text at " << begin;
+    value.type_ = kNumber;
+    value.str_ = text.substr(begin, pos - begin);
+    return value;
+  }
+
+  static std::string ParseString(const std::string &text, size_t &pos) {
+    Expect(text, pos, '"');
+    std::string s;
+    while (pos < text.size() && text[pos] != '"') {
+      char c = text[pos++];
+      if (c == '\\') {
+        CHECK_LT(pos, text.size()) << " Unexpected end of the JSON text";
+        c = text[pos++];
+        switch (c) {
+          case 'b':
+            c = '\b';
+            break;
+          case 'f':
+            c = '\f';
+            break;
+          case 'n':
+            c = '\n';
+            break;
+          case 'r':
+            c = '\r';
+            break;
+          case 't':
+            c = '\t';
+            break;
+          case 'u': {
+            // UTF-8 of a code unit
+            CHECK_LE(pos + 4, text.size()) << " Bad escape in the JSON text";
+            const unsigned code =
+                strtoul(text.substr(pos, 4).c_str(), nullptr, 16);
+            pos += 4;
+            if (code < 0x80) {
+              s += char(code);
+            } else if (code < 0x800) {
+              s += char(0xC0 | (code >> 6));
+              s += char(0x80 | (code & 0x3F));
+            } else {
+              s += char(0xE0 | (code >> 12));
+              s += char(0x80 | ((code >> 6) & 0x3F));
+              s += char(0x80 | (code & 0x3F));
+            }
+            continue;
+          }
+        }
+      }
+      s += c;
+    }
+    Expect(text, pos, '"');
+    return s;
+  }
+
+ private:
+  Type type_ = kNull;
+  bool bool_ = false;
+  std::string str_;  // a string or the text of a number
+  // the elements of an array, or the values of an object
+  std::vector<std::string> keys_;
+  std::vector<JsonValue> values_;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boosted_tree/logging.h>
+
+#include <cstddef>
+#include <string>
+
+// a read-only file mapped into memory, the pages are shared by the processes
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string &fname) : data_(nullptr), size_(0) {
+    const int fd = open(fname.c_str(), O_RDONLY);
+    CHECK(fd >= 0) << "Open file " << fname << " fail!";
+    struct stat st;
+    CHECK(fstat(fd, &st) == 0) << "Stat file " << fname << " fail!";
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void *data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+      CHECK(data != MAP_FAILED) << "Map file " << fname << " fail!";
+      data_ = static_cast<const char *>(data);
+    }
+    close(fd);
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() {
+    if (data_) munmap(const_cast<char *>(data_), size_);
+  }
+
+  inline const char *data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+ private:
+  const char *data_;
+  size_t size_;
+};
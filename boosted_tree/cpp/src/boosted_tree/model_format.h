@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * The binary model format, little-endian
+ *
+ *   ModelHeader
+ *   params: params_size bytes of "name value\n"
+ *   trees: int32[num_trees], the root of every tree
+ *   nodes: Node[num_nodes], 16 bytes {left, feature_id, value, is_leaf,
+ *          miss_left, 2 padding bytes}
+ *
+ * Every section starts at a multiple of kModelAlign bytes, so the nodes of a
+ * mapped file are used without copying.
+ *
+ * Version 2 adds base_margin, which is zero in version 1.
+ */
+constexpr char kModelMagic[4] = {'B', 'S', 'T', 'M'};
+constexpr uint32_t kModelVersion = 2;
+constexpr size_t kModelAlign = 16;
+
+struct ModelHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t num_features;
+  uint32_t num_trees;
+  uint64_t num_nodes;
+  uint32_t params_size;
+  float base_margin;  // the margin before the first tree
+};
+static_assert(sizeof(ModelHeader) == 32, "ModelHeader should be 32 bytes");
+
+inline size_t ModelAlign(const size_t offset) {
+  return (offset + kModelAlign - 1) / kModelAlign * kModelAlign;
+}
+
+inline bool IsLittleEndian() {
+  const uint16_t x = 1;
+  return *reinterpret_cast<const uint8_t *>(&x) == 1;
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <boosted_tree/logging.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./json.h"
+
+/*
+ * The models trained by XGBoost and LightGBM
+ *
+ * A tree is a list of nodes whose root is the first one, an inner node goes
+ * left if x < value, and the missing values go left if miss_left.
+ */
+struct ImportedTree {
+  std::vector<int> left, right, feature_id;
+  std::vector<float> value;
+  std::vector<char> is_leaf, miss_left;
+
+  int AddNode() {
+    left.push_back(-1);
+    right.push_back(-1);
+    feature_id.push_back(0);
+    value.push_back(0);
+    is_leaf.push_back(1);
+    miss_left.push_back(0);
+    return left.size() - 1;
+  }
+};
+
+struct ImportedModel {
+  std::string objective;
+  float base_margin = 0;
+  int num_features = 0;
+  // -1: decided by the loader
+  int zero_as_missing = -1;
+  std::vector<ImportedTree> trees;
+};
+
+/*
+ * XGBoost JSON model (Booster.save_model("model.json")), gbtree only
+ * The entries which are not stored are missing in XGBoost, which matches
+ * zero_as_missing = true if the data has no explicit zeros.
+ */
+inline ImportedModel ParseXGBoostJSON(const std::string &text) {
+  const JsonValue doc = JsonValue::Parse(text);
+  const JsonValue &learner = doc["learner"];
+  const JsonValue &learner_param = learner["learner_model_param"];
+  CHECK_LE(learner_param["num_class"].AsInt(), 1)
+      << " Not supported multi-class XGBoost models";
+  ImportedModel model;
+  model.num_features = learner_param["num_feature"].AsInt();
+  const std::string objective = learner["objective"]["name"].str();
+  if (objective == "binary:logistic") {
+    model.objective = "binary:logistic";
+  } else if (objective == "reg:squarederror" || objective == "reg:linear") {
+    model.objective = "reg:linear";
+  } else {
+    LOG(FATAL) << "Not supported XGBoost objective " << objective;
+  }
+  // base_score is a probability, XGBoost >= 2.0 writes it as "[5E-1]"
+  std::string base_score = learner_param["base_score"].str();
+  if (!base_score.empty() && base_score[0] == '[') {
+    base_score = base_score.substr(1, base_score.size() - 2);
+  }
+  const float score = strtof(base_score.c_str(), nullptr);
+  model.base_margin = model.objective == "binary:logistic"
+                          ? -logf(1.0f / score - 1.0f)
+                          : score;
+  const JsonValue &booster = learner["gradient_booster"];
+  CHECK_EQ(booster["name"].str(), "gbtree")
+      << " Not supported XGBoost booster";
+  for (const JsonValue &tree : booster["model"]["trees"].array()) {
+    const auto &lefts = tree["left_children"].array();
+    const auto &rights = tree["right_children"].array();
+    const auto &features = tree["split_indices"].array();
+    const auto &conditions = tree["split_conditions"].array();
+    const auto &default_left = tree["default_left"].array();
+    const size_t num_nodes = lefts.size();
+    CHECK(rights.size() == num_nodes && features.size() == num_nodes &&
+          conditions.size() == num_nodes && default_left.size() == num_nodes)
+        << "Bad XGBoost tree";
+    if (tree.Has("split_type")) {
+      for (const JsonValue &type : tree["split_type"].array()) {
+        CHECK_EQ(type.AsInt(), 0) << " Not supported categorical splits";
+      }
+    }
+    ImportedTree t;
+    for (size_t i = 0; i < num_nodes; ++i) {
+      const int nid = t.AddNode();
+      t.value[nid] = conditions[i].AsFloat();
+      if (lefts[i].AsInt() == -1) continue;
+      t.is_leaf[nid] = 0;
+      t.left[nid] = lefts[i].AsInt();
+      t.right[nid] = rights[i].AsInt();
+      t.feature_id[nid] = features[i].AsInt();
+      t.miss_left[nid] = default_left[i].AsBool();
+    }
+    model.trees.push_back(std::move(t));
+  }
+  return model;
+}
+
+/*
+ * LightGBM text model (Booster.save_model("model.txt")), numerical splits
+ * LightGBM goes left if x <= threshold in double, which is converted into
+ * x < value in float. The missing type of a split is None (NaN is zero), Zero
+ * or NaN, and zero_as_missing is true if there are the splits of Zero.
+ */
+inline ImportedModel ParseLightGBMText(const std::string &text) {
+  std::stringstream ss(text);
+  std::string line;
+  std::unordered_map<std::string, std::string> header;
+  std::vector<std::unordered_map<std::string, std::string>> blocks;
+  while (std::getline(ss, line)) {
+    if (line == "end of trees") break;
+    const size_t p = line.find('=');
+    if (p == std::string::npos) continue;
+    const std::string key = line.substr(0, p);
+    if (key == "Tree") blocks.emplace_back();
+    (blocks.empty() ? header : blocks.back())[key] = line.substr(p + 1);
+  }
+  auto get = [](const std::unordered_map<std::string, std::string> &kv,
+                const std::string &key) -> std::string {
+    auto it = kv.find(key);
+    CHECK(it != kv.end()) << "No " << key << " in the LightGBM model";
+    return it->second;
+  };
+  auto split = [](const std::string &s) {
+    std::vector<std::string> values;
+    std::stringstream vs(s);
+    std::string v;
+    while (vs >> v) values.push_back(v);
+    return values;
+  };
+  ImportedModel model;
+  CHECK_EQ(get(header, "num_tree_per_iteration"), "1")
+      << " Not supported multi-class LightGBM models";
+  model.num_features = std::stoi(get(header, "max_feature_idx")) + 1;
+  const std::vector<std::string> objective = split(get(header, "objective"));
+  CHECK(!objective.empty()) << "No objective in the LightGBM model";
+  // the leaf values of "binary sigmoid:s" are scaled by s
+  float leaf_scale = 1;
+  if (objective[0] == "binary") {
+    model.objective = "binary:logistic";
+    for (const std::string &arg : objective) {
+      if (arg.compare(0, 8, "sigmoid:") == 0) {
+        leaf_scale = std::stof(arg.substr(8));
+      }
+    }
+  } else if (objective[0] == "regression" ||
+             objective[0] == "regression_l2") {
+    model.objective = "reg:linear";
+  } else {
+    LOG(FATAL) << "Not supported LightGBM objective " << objective[0];
+  }
+  std::vector<int> missing_types;
+  for (const auto &block : blocks) {
+    const int num_leaves = std::stoi(get(block, "num_leaves"));
+    CHECK_GE(num_leaves, 1) << " Bad LightGBM tree";
+    const auto leaf_values = split(get(block, "leaf_value"));
+    CHECK_EQ(leaf_values.size(), num_leaves) << " Bad LightGBM tree";
+    ImportedTree t;
+    if (num_leaves == 1) {
+      t.value[t.AddNode()] = std::stod(leaf_values[0]) * leaf_scale;
+      model.trees.push_back(std::move(t));
+      continue;
+    }
+    CHECK_EQ(get(block, "num_cat"), "0")
+        << " Not supported categorical splits";
+    const auto features = split(get(block, "split_feature"));
+    const auto thresholds = split(get(block, "threshold"));
+    const auto decision_types = split(get(block, "decision_type"));
+    const auto lefts = split(get(block, "left_child"));
+    const auto rights = split(get(block, "right_child"));
+    // the inner nodes are [0, num_leaves - 1), and the leaves follow them
+    const size_t num_inner = num_leaves - 1;
+    CHECK(features.size() == num_inner && thresholds.size() == num_inner &&
+          decision_types.size() == num_inner && lefts.size() == num_inner &&
+          rights.size() == num_inner)
+        << "Bad LightGBM tree";
+    for (size_t i = 0; i < num_inner + num_leaves; ++i) t.AddNode();
+    auto child = [num_inner](const std::string &s) {
+      const int c = std::stoi(s);
+      return c >= 0 ? c : static_cast<int>(num_inner) + ~c;
+    };
+    for (size_t i = 0; i < num_inner; ++i) {
+      const int decision_type = std::stoi(decision_types[i]);
+      CHECK(!(decision_type & 1)) << "Not supported categorical splits";
+      const bool default_left = decision_type & 2;
+      const int missing_type = (decision_type >> 2) & 3;
+      const double threshold = std::stod(thresholds[i]);
+      // the largest float <= threshold, x <= it iff x < the next float
+      float value = threshold;
+      if (value > threshold) value = nextafterf(value, -INFINITY);
+      t.is_leaf[i] = 0;
+      t.value[i] = nextafterf(value, INFINITY);
+      t.feature_id[i] = std::stoi(features[i]);
+      t.left[i] = child(lefts[i]);
+      t.right[i] = child(rights[i]);
+      // None: NaN is converted into zero
+      t.miss_left[i] = missing_type == 0 ? 0 <= threshold : default_left;
+      missing_types.push_back(missing_type);
+    }
+    for (int i = 0; i < num_leaves; ++i) {
+      t.value[num_inner + i] = std::stod(leaf_values[i]) * leaf_scale;
+    }
+    model.trees.push_back(std::move(t));
+  }
+  int num_zero = 0, num_nan = 0;
+  for (int type : missing_types) {
+    num_zero += type == 1;
+    num_nan += type == 2;
+  }
+  model.zero_as_missing = num_zero > 0;
+  if (num_zero > 0 && num_nan > 0) {
+    LOG(WARNING) << num_nan << " splits of the missing type NaN treat the "
+                 << "zeros as missing values with zero_as_missing";
+  }
+  return model;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/*
+ * QuickScorer: the forest is scored feature by feature instead of tree by tree
+ *
+ * The leaves of a tree are numbered from left to right, and a tree keeps a
+ * bitvector of the leaves which can still be reached. A false condition
+ * (x >= threshold, or missing with miss_left = false) clears the leaves of
+ * the left subtree of its node, and the exit leaf is the lowest bit left.
+ * The conditions of a feature are sorted by threshold, so only the false ones
+ * are visited. The trees with more than kMaxLeaves leaves are traversed.
+ *
+ * Lucchese, Claudio, et al. "QuickScorer: A Fast Algorithm to Rank Documents
+ * with Additive Ensembles of Regression Trees." (2015).
+ */
+class QuickScorer {
+ public:
+  static constexpr int kMaxLeaves = 64;
+
+ public:
+  template <typename NodeT>
+  void Build(const NodeT *nodes, const std::vector<int> &trees) {
+    tree_ids_.clear();
+    fallback_trees_.clear();
+    leaf_values_.clear();
+    features_.clear();
+    std::vector<std::pair<int, Condition>> conds, miss_conds;
+    for (int t = 0; t < static_cast<int>(trees.size()); ++t) {
+      if (NumLeaves(nodes, trees[t]) > kMaxLeaves) {
+        fallback_trees_.push_back(t);
+        continue;
+      }
+      const int slot = tree_ids_.size();
+      tree_ids_.push_back(t);
+      leaf_values_.resize((slot + 1) * kMaxLeaves, 0);
+      int num_leaves = 0;
+      // number the leaves under nid from left to right
+      std::function<void(int)> F;
+      F = [&](const int nid) {
+        const NodeT &node = nodes[nid];
+        if (node.is_leaf) {
+          leaf_values_[slot * kMaxLeaves + num_leaves++] = node.value;
+          return;
+        }
+        const int first = num_leaves;
+        F(node.left);
+        const int last = num_leaves;
+        // last < kMaxLeaves since the right subtree has a leaf at least
+        const uint64_t left_leaves =
+            ((uint64_t(1) << last) - 1) & ~((uint64_t(1) << first) - 1);
+        const Condition cond{node.value, slot, ~left_leaves};
+        conds.emplace_back(node.feature_id, cond);
+        if (!node.miss_left) miss_conds.emplace_back(node.feature_id, cond);
+        F(node.right());
+      };
+      F(trees[t]);
+    }
+    for (auto &p : conds) features_.push_back(p.first);
+    std::sort(features_.begin(), features_.end());
+    features_.erase(std::unique(features_.begin(), features_.end()),
+                    features_.end());
+    auto by_feature = [](const std::pair<int, Condition> &a,
+                         const std::pair<int, Condition> &b) {
+      if (a.first != b.first) return a.first < b.first;
+      return a.second.threshold < b.second.threshold;
+    };
+    Group(conds, by_feature, &cond_ptrs_, &conds_);
+    Group(miss_conds, by_feature, &miss_ptrs_, &miss_conds_);
+  }
+
+  /*
+   * x is a dense row, write the predictions of the trees into values[t]
+   * except for the fallback trees
+   */
+  template <typename MissingFn>
+  void Predict(const float *x, MissingFn is_missing, float *values) const {
+    static thread_local std::vector<uint64_t> bitvectors;
+    bitvectors.assign(tree_ids_.size(), ~uint64_t(0));
+    for (size_t i = 0; i < features_.size(); ++i) {
+      const float v = x[features_[i]];
+      if (is_missing(v)) {
+        for (int k = miss_ptrs_[i]; k < miss_ptrs_[i + 1]; ++k) {
+          bitvectors[miss_conds_[k].tree] &= miss_conds_[k].mask;
+        }
+      } else {
+        for (int k = cond_ptrs_[i];
+             k < cond_ptrs_[i + 1] && conds_[k].threshold <= v; ++k) {
+          bitvectors[conds_[k].tree] &= conds_[k].mask;
+        }
+      }
+    }
+    for (size_t s = 0; s < tree_ids_.size(); ++s) {
+      const int leaf = __builtin_ctzll(bitvectors[s]);
+      values[tree_ids_[s]] = leaf_values_[s * kMaxLeaves + leaf];
+    }
+  }
+
+  // the trees with too many leaves, whose values are not written by Predict
+  inline const std::vector<int> &FallbackTrees() const {
+    return fallback_trees_;
+  }
+
+ private:
+  struct Condition {
+    float threshold;
+    int tree;  // the slot of the tree
+    uint64_t mask;
+  };
+
+ private:
+  template <typename NodeT>
+  static int NumLeaves(const NodeT *nodes, const int nid) {
+    const NodeT &node = nodes[nid];
+    if (node.is_leaf) return 1;
+    return NumLeaves(nodes, node.left) + NumLeaves(nodes, node.right());
+  }
+
+  // sort the conditions, ptrs[i] is the first condition of features_[i]
+  template <typename Compare>
+  void Group(std::vector<std::pair<int, Condition>> &conds, Compare comp,
+             std::vector<int> *ptrs, std::vector<Condition> *out) const {
+    std::stable_sort(conds.begin(), conds.end(), comp);
+    ptrs->assign(features_.size() + 1, 0);
+    out->clear();
+    size_t k = 0;
+    for (size_t i = 0; i < features_.size(); ++i) {
+      (*ptrs)[i] = out->size();
+      for (; k < conds.size() && conds[k].first == features_[i]; ++k) {
+        out->push_back(conds[k].second);
+      }
+    }
+    (*ptrs)[features_.size()] = out->size();
+  }
+
+ private:
+  // the index of the tree in the forest of every slot
+  std::vector<int> tree_ids_;
+  std::vector<int> fallback_trees_;
+  std::vector<float> leaf_values_;  // kMaxLeaves values per slot
+  // the features used by the trees, and their conditions
+  std::vector<int> features_;
+  std::vector<int> cond_ptrs_;
+  std::vector<Condition> conds_;
+  // the conditions whose missing values go right
+  std::vector<int> miss_ptrs_;
+  std::vector<Condition> miss_conds_;
+};
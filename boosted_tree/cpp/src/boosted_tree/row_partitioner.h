@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <vector>
+
+// the sample ids of a node, a slice of the index buffer
+class RowSlice {
+ public:
+  RowSlice() : first_(nullptr), last_(nullptr) {}
+  RowSlice(const int *first, const int *last) : first_(first), last_(last) {}
+  inline const int *begin() const { return first_; }
+  inline const int *end() const { return last_; }
+  inline size_t size() const { return last_ - first_; }
+  inline bool empty() const { return first_ == last_; }
+  inline int operator[](size_t i) const { return first_[i]; }
+
+ private:
+  const int *first_, *last_;
+};
+
+/*
+ * Row indices of the nodes of a tree
+ *
+ * The sample ids of a tree are kept in one index buffer, and a node owns the
+ * slice [begin, end) of the buffer. Splitting a node partitions its slice in
+ * place and keeps the order of the samples, the left child owns [begin, mid)
+ * and the right child owns [mid, end). The sample ids of a slice are sorted
+ * if the sample ids of the tree are sorted.
+ */
+class RowPartitioner {
+ public:
+  // a thread partitions at least kMinBlockRows rows
+  static constexpr size_t kMinBlockRows = 4096;
+
+ public:
+  void Reset(int num_rows) {
+    rows_.resize(num_rows);
+    std::iota(rows_.begin(), rows_.end(), 0);
+    scratch_.resize(num_rows);
+  }
+
+  // the tree is built on a subset of the samples
+  void Reset(const std::vector<int> &rows) {
+    rows_ = rows;
+    scratch_.resize(rows_.size());
+  }
+
+  inline RowSlice Slice(size_t begin, size_t end) const {
+    return RowSlice(rows_.data() + begin, rows_.data() + end);
+  }
+
+  /*
+   * go_left(sample_id) -> bool, return mid
+   * The slices of different nodes can be partitioned concurrently with
+   * n_jobs = 1.
+   */
+  template <typename Pred>
+  size_t Partition(size_t begin, size_t end, Pred go_left, int n_jobs) {
+    const size_t n = end - begin;
+    const int num_blocks = std::max(
+        1, std::min(n_jobs, static_cast<int>(n / kMinBlockRows)));
+    if (num_blocks == 1) {
+      const size_t mid = begin + PartitionBlock(begin, end, go_left);
+      std::copy(scratch_.begin() + begin, scratch_.begin() + mid,
+                rows_.begin() + begin);
+      std::reverse_copy(scratch_.begin() + mid, scratch_.begin() + end,
+                        rows_.begin() + mid);
+      return mid;
+    }
+    const size_t block_size = (n + num_blocks - 1) / num_blocks;
+    block_left_.assign(num_blocks + 1, 0);
+#pragma omp parallel for num_threads(num_blocks)
+    for (int b = 0; b < num_blocks; ++b) {
+      const size_t first = begin + std::min(n, b * block_size);
+      const size_t last = begin + std::min(n, (b + 1) * block_size);
+      block_left_[b + 1] = PartitionBlock(first, last, go_left);
+    }
+    std::partial_sum(block_left_.begin(), block_left_.end(),
+                     block_left_.begin());
+    const size_t mid = begin + block_left_[num_blocks];
+#pragma omp parallel for num_threads(num_blocks)
+    for (int b = 0; b < num_blocks; ++b) {
+      const size_t first = begin + std::min(n, b * block_size);
+      const size_t last = begin + std::min(n, (b + 1) * block_size);
+      const size_t num_left = block_left_[b + 1] - block_left_[b];
+      std::copy(scratch_.begin() + first, scratch_.begin() + first + num_left,
+                rows_.begin() + begin + block_left_[b]);
+      // the number of the right rows in the previous blocks
+      const size_t right_offset = first - begin - block_left_[b];
+      std::reverse_copy(scratch_.begin() + first + num_left,
+                        scratch_.begin() + last,
+                        rows_.begin() + mid + right_offset);
+    }
+    return mid;
+  }
+
+ private:
+  // write the left rows of [first, last) forward and the right rows backward
+  // into the scratch buffer, return the number of the left rows
+  template <typename Pred>
+  size_t PartitionBlock(size_t first, size_t last, Pred &go_left) {
+    size_t l = first, r = last;
+    for (size_t i = first; i < last; ++i) {
+      const int row = rows_[i];
+      if (go_left(row))
+        scratch_[l++] = row;
+      else
+        scratch_[--r] = row;
+    }
+    return l - first;
+  }
+
+ private:
+  std::vector<int> rows_;
+  std::vector<int> scratch_;
+  std::vector<size_t> block_left_;
+};
@@ -0,0 +1,134 @@
+#include <boosted_tree/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./serving/socket.h"
+
+/*
+ * The load generator of the prediction server
+ * Every connection sends the rows of a libsvm file one by one, and waits for
+ * the response of a request before sending the next one.
+ */
+
+void Usage() {
+  LOG(INFO) << "./load_gen --data <libsvm fname> [--unix <path> | --port "
+               "<port>] [--connections 16] [--requests 10000] [--binary]";
+}
+
+int main(int argc, char **argv) {
+  std::string data_fname;
+  Address addr;
+  int num_connections = 16, num_requests = 10000;
+  bool binary = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::string key = argv[i];
+    if (key == "--binary") {
+      binary = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      Usage();
+      return -1;
+    }
+    const std::string value = argv[++i];
+    if (key == "--data") {
+      data_fname = value;
+    } else if (key == "--unix") {
+      addr.unix_path = value;
+    } else if (key == "--port") {
+      addr.port = std::stoi(value);
+    } else if (key == "--connections") {
+      num_connections = std::stoi(value);
+    } else if (key == "--requests") {
+      num_requests = std::stoi(value);
+    } else {
+      Usage();
+      return -1;
+    }
+  }
+  if (data_fname.empty() || (addr.unix_path.empty() && addr.port == 0)) {
+    Usage();
+    return -1;
+  }
+  CHECK_GT(num_connections, 0);
+  CHECK_GT(num_requests, 0);
+
+  // the requests in the text and binary modes
+  std::vector<std::string> lines, frames;
+  std::ifstream fin(data_fname);
+  CHECK(fin.is_open()) << "Open file " << data_fname << " fail!";
+  std::string line;
+  std::vector<int32_t> indices;
+  std::vector<float> values;
+  while (std::getline(fin, line)) {
+    if (!ParseLibSVMRow(line, &indices, &values)) continue;
+    lines.push_back(line + '\n');
+    std::string frame(4 + indices.size() * 8, '\0');
+    const uint32_t nnz = indices.size();
+    std::memcpy(&frame[0], &nnz, 4);
+    for (size_t k = 0; k < indices.size(); ++k) {
+      std::memcpy(&frame[4 + k * 8], &indices[k], 4);
+      std::memcpy(&frame[8 + k * 8], &values[k], 4);
+    }
+    frames.push_back(frame);
+  }
+  CHECK(!lines.empty()) << "No rows in " << data_fname;
+
+  std::vector<std::vector<int64_t>> latencies(num_connections);
+  std::vector<int> num_errors(num_connections, 0);
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int c = 0; c < num_connections; ++c) {
+    threads.emplace_back([&, c]() {
+      const int fd = Connect(addr);
+      SocketReader reader(fd);
+      if (binary) CHECK(WriteAll(fd, "\0", 1)) << "Write fail!";
+      std::string response;
+      for (int i = 0; i < num_requests; ++i) {
+        const size_t r = (size_t(c) * num_requests + i) % lines.size();
+        const auto t0 = std::chrono::steady_clock::now();
+        bool ok;
+        if (binary) {
+          float pred;
+          ok = WriteAll(fd, frames[r].data(), frames[r].size()) &&
+               reader.Read(&pred, sizeof(pred));
+        } else {
+          ok = WriteAll(fd, lines[r].data(), lines[r].size()) &&
+               reader.ReadLine(&response);
+          if (ok && response == "error") ++num_errors[c];
+        }
+        CHECK(ok) << "The connection is closed";
+        latencies[c].push_back(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - t0)
+                .count());
+      }
+      close(fd);
+    });
+  }
+  for (std::thread &t : threads) t.join();
+  const double elapsed = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  std::vector<int64_t> lat;
+  int errors = 0;
+  for (int c = 0; c < num_connections; ++c) {
+    lat.insert(lat.end(), latencies[c].begin(), latencies[c].end());
+    errors += num_errors[c];
+  }
+  std::sort(lat.begin(), lat.end());
+  LOG(INFO) << "Requests: " << lat.size() << " Errors: " << errors
+            << " Throughput: " << lat.size() / elapsed << "/s"
+            << " p50: " << lat[lat.size() / 2] << "us"
+            << " p99: " << lat[lat.size() * 99 / 100] << "us";
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <boosted_tree/boosted_tree.h>
+#include <boosted_tree/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./serving/micro_batcher.h"
+#include "./serving/socket.h"
+
+void Usage() {
+  LOG(INFO) << "./server --model <fname> [--xgboost <fname>] "
+               "[--lightgbm <fname>] [--unix <path> | --port <port>] "
+               "[--max-batch 256] [--max-delay-us 500] [--predictor block] "
+               "[--n-jobs 1] [--zero-as-missing] [--report-seconds 5]";
+}
+
+void ServeConnection(const int fd, MicroBatcher *batcher) {
+  batcher->AddClient();
+  SocketReader reader(fd);
+  std::vector<int32_t> indices;
+  std::vector<float> values;
+  if (reader.Peek() == 0) {
+    // binary mode
+    char mode;
+    reader.Read(&mode, 1);
+    while (1) {
+      const ReadStatus status = ReadBinaryRow(&reader, &indices, &values);
+      if (status == ReadStatus::kBad) {
+        LOG(WARNING) << "Close the connection of a bad binary request";
+      }
+      if (status != ReadStatus::kOk) break;
+      const float pred = batcher->Predict(indices, values);
+      if (!WriteAll(fd, &pred, sizeof(pred))) break;
+    }
+  } else {
+    std::string line;
+    char buf[32];
+    while (reader.ReadLine(&line)) {
+      if (!ParseLibSVMRow(line, &indices, &values)) {
+        if (!WriteAll(fd, "error\n", 6)) break;
+        continue;
+      }
+      const float pred = batcher->Predict(indices, values);
+      const int n = snprintf(buf, sizeof(buf), "%.9g\n", pred);
+      if (!WriteAll(fd, buf, n)) break;
+    }
+  }
+  batcher->RemoveClient();
+  close(fd);
+}
+
+void Report(MicroBatcher *batcher, const int seconds) {
+  auto last = std::chrono::steady_clock::now();
+  while (1) {
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    MicroBatcher::Stats stats = batcher->TakeStats();
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - last).count();
+    last = now;
+    if (stats.num_requests == 0) continue;
+    std::vector<int64_t> &lat = stats.latencies;
+    std::sort(lat.begin(), lat.end());
+    LOG(INFO) << "Requests: " << stats.num_requests
+              << " Throughput: " << stats.num_requests / elapsed << "/s"
+              << " Batch: " << double(stats.num_requests) / stats.num_batches
+              << " p50: " << lat[lat.size() / 2] << "us"
+              << " p99: " << lat[lat.size() * 99 / 100] << "us";
+  }
+}
+
+int main(int argc, char **argv) {
+  BoostedTreeParam param;
+  param.predictor = "block";
+  std::string model_fname, xgboost_fname, lightgbm_fname;
+  Address addr;
+  int max_batch = 256, max_delay_us = 500, report_seconds = 5;
+  for (int i = 1; i < argc; ++i) {
+    const std::string key = argv[i];
+    if (key == "--zero-as-missing") {
+      param.zero_as_missing = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      Usage();
+      return -1;
+    }
+    const std::string value = argv[++i];
+    if (key == "--model") {
+      model_fname = value;
+    } else if (key == "--xgboost") {
+      xgboost_fname = value;
+    } else if (key == "--lightgbm") {
+      lightgbm_fname = value;
+    } else if (key == "--unix") {
+      addr.unix_path = value;
+    } else if (key == "--port") {
+      addr.port = std::stoi(value);
+    } else if (key == "--max-batch") {
+      max_batch = std::stoi(value);
+    } else if (key == "--max-delay-us") {
+      max_delay_us = std::stoi(value);
+    } else if (key == "--predictor") {
+      param.predictor = value;
+    } else if (key == "--n-jobs") {
+      param.n_jobs = std::stoi(value);
+    } else if (key == "--report-seconds") {
+      report_seconds = std::stoi(value);
+    } else {
+      Usage();
+      return -1;
+    }
+  }
+  if ((model_fname.empty() && xgboost_fname.empty() &&
+       lightgbm_fname.empty()) ||
+      (addr.unix_path.empty() && addr.port == 0)) {
+    Usage();
+    return -1;
+  }
+  CHECK_GT(max_batch, 0);
+  CHECK_GE(max_delay_us, 0);
+
+  BoostedTree bst(param);
+  if (!model_fname.empty()) bst.load_model(model_fname);
+  if (!xgboost_fname.empty()) bst.load_xgboost_model(xgboost_fname);
+  if (!lightgbm_fname.empty()) bst.load_lightgbm_model(lightgbm_fname);
+  // a response is a float
+  CHECK_EQ(bst.num_outputs(), 1)
+      << "The server returns a prediction per row, the model of "
+      << bst.num_outputs() << " outputs per row isn't supported";
+  MicroBatcher batcher(
+      [&bst](const CSRMatrix<float> &X) { return bst.predict(X); }, max_batch,
+      max_delay_us);
+  const int listen_fd = Listen(addr);
+  if (addr.unix_path.empty()) {
+    LOG(INFO) << "Listen on 127.0.0.1:" << addr.port;
+  } else {
+    LOG(INFO) << "Listen on " << addr.unix_path;
+  }
+  std::thread(Report, &batcher, report_seconds).detach();
+  while (1) {
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) continue;
+    if (addr.unix_path.empty()) SetNoDelay(fd);
+    std::thread(ServeConnection, fd, &batcher).detach();
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <boosted_tree/csr_matrix.h>
+#include <boosted_tree/vec.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Coalesce the concurrent single-row requests into micro-batches
+ *
+ * A batch is predicted when it has max_batch rows, when the oldest request
+ * has waited for max_delay, or when every connected client is waiting, since
+ * no more requests can come before a response in that case.
+ */
+class MicroBatcher {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using PredictFunc = std::function<Vec<float>(const CSRMatrix<float> &)>;
+
+  struct Stats {
+    int64_t num_requests = 0;
+    int64_t num_batches = 0;
+    // the latencies of the requests in microseconds, from arrival to response
+    std::vector<int64_t> latencies;
+  };
+
+ public:
+  MicroBatcher(PredictFunc predict, const int max_batch,
+               const int max_delay_us)
+      : predict_(predict),
+        max_batch_(max_batch),
+        max_delay_(max_delay_us),
+        num_clients_(0),
+        stop_(false) {
+    worker_ = std::thread([this]() { Loop(); });
+  }
+  MicroBatcher(const MicroBatcher &) = delete;
+  MicroBatcher &operator=(const MicroBatcher &) = delete;
+  ~MicroBatcher() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      stop_ = true;
+    }
+    batch_cv_.notify_one();
+    worker_.join();
+  }
+
+  void AddClient() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    ++num_clients_;
+  }
+
+  void RemoveClient() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      --num_clients_;
+    }
+    batch_cv_.notify_one();
+  }
+
+  // block until the row is predicted
+  float Predict(const std::vector<int32_t> &indices,
+                const std::vector<float> &values) {
+    Request req{&indices, &values, 0, false, Clock::now()};
+    std::unique_lock<std::mutex> lock(mtx_);
+    queue_.push_back(&req);
+    if (queue_.size() == 1 || BatchReady()) batch_cv_.notify_one();
+    done_cv_.wait(lock, [&req]() { return req.done; });
+    return req.result;
+  }
+
+  // return the stats since the last call
+  Stats TakeStats() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    Stats stats;
+    std::swap(stats, stats_);
+    return stats;
+  }
+
+ private:
+  struct Request {
+    const std::vector<int32_t> *indices;
+    const std::vector<float> *values;
+    float result;
+    bool done;
+    Clock::time_point arrival;
+  };
+
+ private:
+  inline bool BatchReady() const {
+    const int size = queue_.size();
+    return size >= max_batch_ || size >= num_clients_;
+  }
+
+  void Loop() {
+    std::vector<Request *> batch;
+    std::vector<dim_t> row, col;
+    std::vector<float> data;
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (1) {
+      batch_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) break;
+      const Clock::time_point deadline = queue_.front()->arrival + max_delay_;
+      batch_cv_.wait_until(lock, deadline,
+                           [this]() { return stop_ || BatchReady(); });
+      const int size = std::min<int>(queue_.size(), max_batch_);
+      batch.assign(queue_.begin(), queue_.begin() + size);
+      queue_.erase(queue_.begin(), queue_.begin() + size);
+      lock.unlock();
+
+      row.clear();
+      col.clear();
+      data.clear();
+      dim_t num_cols = 1;
+      for (int r = 0; r < size; ++r) {
+        const std::vector<int32_t> &indices = *batch[r]->indices;
+        const std::vector<float> &values = *batch[r]->values;
+        for (size_t k = 0; k < indices.size(); ++k) {
+          row.push_back(r);
+          col.push_back(indices[k]);
+          data.push_back(values[k]);
+          num_cols = std::max<dim_t>(num_cols, indices[k] + 1);
+        }
+      }
+      CSRMatrix<float> X(size, num_cols);
+      X.reset(row, col, data);
+      const Vec<float> preds = predict_(X);
+
+      lock.lock();
+      const Clock::time_point now = Clock::now();
+      for (int r = 0; r < size; ++r) {
+        batch[r]->result = preds[r];
+        batch[r]->done = true;
+        stats_.latencies.push_back(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                now - batch[r]->arrival)
+                .count());
+      }
+      stats_.num_requests += size;
+      ++stats_.num_batches;
+      done_cv_.notify_all();
+    }
+  }
+
+ private:
+  PredictFunc predict_;
+  const int max_batch_;
+  const std::chrono::microseconds max_delay_;
+  int num_clients_;
+  bool stop_;
+  std::deque<Request *> queue_;
+  Stats stats_;
+  std::mutex mtx_;
+  std::condition_variable batch_cv_, done_cv_;
+  std::thread worker_;
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <boosted_tree/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+/*
+ * The protocol of the prediction server
+ *
+ * The first byte of a connection decides its mode.
+ *   text: a request is a libsvm row ending with '\n', the label is optional,
+ *         and the response is the prediction ending with '\n'
+ *   binary: the first byte is 0, a request is uint32 nnz followed by nnz
+ *           pairs of (int32 index, float value), and the response is a
+ *           float, all little-endian
+ *
+ * A connection sending a bad binary request is closed, since the stream
+ * can't be resynchronized. A bad text request is answered with "error".
+ *
+ * The address is a path of a Unix domain socket, or a port of the TCP
+ * loopback 127.0.0.1.
+ */
+// the maximum number of the features of a request
+constexpr uint32_t kMaxRequestNNZ = 1 << 20;
+
+struct Address {
+  std::string unix_path;
+  int port = 0;
+};
+
+// the messages are small, send them without waiting to coalesce
+inline void SetNoDelay(const int fd) {
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+inline int Listen(const Address &addr) {
+  int fd;
+  if (!addr.unix_path.empty()) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(fd >= 0) << "Create socket fail!";
+    sockaddr_un sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    CHECK_LT(addr.unix_path.size(), sizeof(sa.sun_path)) << " Too long path";
+    std::strcpy(sa.sun_path, addr.unix_path.c_str());
+    unlink(addr.unix_path.c_str());
+    CHECK(bind(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)) == 0)
+        << "Bind " << addr.unix_path << " fail!";
+  } else {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(fd >= 0) << "Create socket fail!";
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(addr.port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)) == 0)
+        << "Bind 127.0.0.1:" << addr.port << " fail!";
+  }
+  CHECK(listen(fd, 128) == 0) << "Listen fail!";
+  return fd;
+}
+
+inline int Connect(const Address &addr) {
+  int fd;
+  if (!addr.unix_path.empty()) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(fd >= 0) << "Create socket fail!";
+    sockaddr_un sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    CHECK_LT(addr.unix_path.size(), sizeof(sa.sun_path)) << " Too long path";
+    std::strcpy(sa.sun_path, addr.unix_path.c_str());
+    CHECK(connect(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)) == 0)
+        << "Connect " << addr.unix_path << " fail!";
+  } else {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(fd >= 0) << "Create socket fail!";
+    sockaddr_in sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(addr.port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(connect(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)) == 0)
+        << "Connect 127.0.0.1:" << addr.port << " fail!";
+    SetNoDelay(fd);
+  }
+  return fd;
+}
+
+inline bool WriteAll(const int fd, const void *data, size_t size) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    const ssize_t n = write(fd, p, size);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// a buffered reader of a connection
+class SocketReader {
+ public:
+  explicit SocketReader(const int fd) : fd_(fd), begin_(0), end_(0) {
+    buf_.resize(1 << 16);
+  }
+
+  // return false if the connection is closed
+  bool ReadLine(std::string *line) {
+    line->clear();
+    while (1) {
+      if (begin_ == end_ && !Fill()) return false;
+      const char *first = buf_.data() + begin_;
+      const char *last = buf_.data() + end_;
+      const char *p =
+          static_cast<const char *>(std::memchr(first, '\n', last - first));
+      if (p) {
+        line->append(first, p);
+        begin_ += p - first + 1;
+        return true;
+      }
+      line->append(first, last);
+      begin_ = end_;
+    }
+  }
+
+  bool Read(void *data, size_t size) {
+    char *out = static_cast<char *>(data);
+    while (size > 0) {
+      if (begin_ == end_ && !Fill()) return false;
+      const size_t n = std::min(size, end_ - begin_);
+      std::memcpy(out, buf_.data() + begin_, n);
+      begin_ += n;
+      out += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  // return -1 if the connection is closed
+  int Peek() {
+    if (begin_ == end_ && !Fill()) return -1;
+    return static_cast<unsigned char>(buf_[begin_]);
+  }
+
+ private:
+  bool Fill() {
+    const ssize_t n = read(fd_, buf_.data(), buf_.size());
+    if (n <= 0) return false;
+    begin_ = 0;
+    end_ = n;
+    return true;
+  }
+
+ private:
+  int fd_;
+  std::vector<char> buf_;
+  size_t begin_, end_;
+};
+
+// parse a libsvm row "[label] index:value ...", return false if it is bad
+inline bool ParseLibSVMRow(const std::string &line,
+                           std::vector<int32_t> *indices,
+                           std::vector<float> *values) {
+  indices->clear();
+  values->clear();
+  const char *p = line.c_str();
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r') ++p;
+    if (!*p) break;
+    const char *token = p;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+    const char *colon =
+        static_cast<const char *>(std::memchr(token, ':', p - token));
+    if (!colon) {
+      // the tokens before the features, e.g. the label, are skipped
+      if (!indices->empty()) return false;
+      continue;
+    }
+    char *end;
+    const long index = strtol(token, &end, 10);
+    if (end != colon || index < 0 ||
+        index > std::numeric_limits<int32_t>::max()) {
+      return false;
+    }
+    const float value = strtof(colon + 1, &end);
+    if (end == colon + 1 || end != p) return false;
+    if (indices->size() == kMaxRequestNNZ) return false;
+    indices->push_back(index);
+    values->push_back(value);
+  }
+  return true;
+}
+
+enum class ReadStatus { kOk, kClosed, kBad };
+
+// read a binary request, its nnz and indices are checked before a feature is
+// stored
+inline ReadStatus ReadBinaryRow(SocketReader *reader,
+                                std::vector<int32_t> *indices,
+                                std::vector<float> *values) {
+  uint32_t nnz;
+  if (!reader->Read(&nnz, sizeof(nnz))) return ReadStatus::kClosed;
+  if (nnz > kMaxRequestNNZ) return ReadStatus::kBad;
+  indices->resize(nnz);
+  values->resize(nnz);
+  for (uint32_t k = 0; k < nnz; ++k) {
+    if (!reader->Read(&(*indices)[k], sizeof(int32_t)) ||
+        !reader->Read(&(*values)[k], sizeof(float))) {
+      return ReadStatus::kClosed;
+    }
+    if ((*indices)[k] < 0) return ReadStatus::kBad;
+  }
+  return ReadStatus::kOk;
+}
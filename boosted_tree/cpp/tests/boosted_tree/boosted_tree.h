@@ -0,0 +1,8 @@
+#pragma once
+#include "./test_tree_method.h"
+#include "./test_block_predictor.h"
+#include "./test_compiled_model.h"
+#include "./test_model_format.h"
+#include "./test_model_import.h"
+#include "./test_staged_predict.h"
+#include "./test_multiclass.h"
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <boosted_tree/boosted_tree.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../../src/boosted_tree/block_predictor.h"
+#include "./test_model_import.h"
+
+// the nodes viewed as 4 words {left, feature_id, value, flags}
+class BlockForest {
+ public:
+  explicit BlockForest(const int num_features) : num_features_(num_features) {}
+
+  // a random tree of the given depth, return its root
+  int AddTree(const int depth) {
+    const int root = NewNode();
+    Grow(root, depth);
+    roots_.push_back(root);
+    return root;
+  }
+
+  // the prediction of a dense row by traversing the trees one by one
+  float Predict(const float *x, const bool zero_as_missing,
+                float margin) const {
+    for (int root : roots_) {
+      int idx = root;
+      while (!IsLeaf(idx)) {
+        const float v = x[words_[idx * 4 + 1]];
+        const bool missing = std::isnan(v) || (zero_as_missing && v == 0);
+        const bool is_left = missing ? MissLeft(idx) : v < Value(idx);
+        idx = words_[idx * 4] + (is_left ? 0 : 1);
+      }
+      margin += Value(idx);
+    }
+    return margin;
+  }
+
+  inline const int32_t *Nodes() const { return words_.data(); }
+  inline const std::vector<int> &Roots() const { return roots_; }
+
+ private:
+  int NewNode() {
+    words_.resize(words_.size() + 4, 0);
+    return words_.size() / 4 - 1;
+  }
+
+  void Grow(const int idx, const int depth) {
+    const float value = float(rand() % 2000) / 1000 - 1;
+    std::memcpy(&words_[idx * 4 + 2], &value, sizeof(value));
+    uint8_t *flags = reinterpret_cast<uint8_t *>(&words_[idx * 4 + 3]);
+    if (depth == 0 || rand() % 8 == 0) {
+      flags[0] = 1;
+      return;
+    }
+    flags[1] = rand() % 2;
+    words_[idx * 4 + 1] = rand() % num_features_;
+    // the children are adjacent
+    const int left = NewNode();
+    NewNode();
+    words_[idx * 4] = left;
+    Grow(left, depth - 1);
+    Grow(left + 1, depth - 1);
+  }
+
+  inline bool IsLeaf(const int idx) const {
+    return reinterpret_cast<const uint8_t *>(&words_[idx * 4 + 3])[0];
+  }
+  inline bool MissLeft(const int idx) const {
+    return reinterpret_cast<const uint8_t *>(&words_[idx * 4 + 3])[1];
+  }
+  inline float Value(const int idx) const {
+    float value;
+    std::memcpy(&value, &words_[idx * 4 + 2], sizeof(value));
+    return value;
+  }
+
+ private:
+  int num_features_;
+  std::vector<int32_t> words_;
+  std::vector<int> roots_;
+};
+
+TEST(TestBlockPredictor, lanes) {
+  // every supported width predicts the rows as the traversal does
+  const int num_features = 6, num_rows = BlockPredictor::kBlockRows;
+  srand(11);
+  BlockForest forest(num_features);
+  for (int t = 0; t < 20; ++t) forest.AddTree(t % 7);
+  // a fifth of the values are missing and another fifth are zeros
+  std::vector<float> x(num_rows * num_features);
+  for (float &v : x) {
+    const int r = rand() % 5;
+    v = r == 0 ? NAN : r == 1 ? 0 : float(rand() % 2000) / 1000 - 1;
+  }
+  ASSERT_EQ(BlockPredictor(1).Lanes(), 1);
+  ASSERT_GE(BlockPredictor().Lanes(), 1);
+  const std::vector<int> &roots = forest.Roots();
+  for (const int lanes : {1, 8, 16}) {
+    if (!BlockPredictor::Supports(lanes)) continue;
+    const BlockPredictor predictor(lanes);
+    ASSERT_EQ(predictor.Lanes(), lanes);
+    for (const bool zero_as_missing : {false, true}) {
+      std::vector<float> out(num_rows, 0.5);
+      for (int r = 0; r + lanes <= num_rows; r += lanes) {
+        predictor.Traverse(forest.Nodes(), roots.data(), roots.size(),
+                           x.data() + r * num_features, num_features,
+                           zero_as_missing, out.data() + r);
+      }
+      for (int r = 0; r < num_rows; ++r) {
+        ASSERT_EQ(out[r], forest.Predict(x.data() + r * num_features,
+                                         zero_as_missing, 0.5))
+            << lanes << " " << zero_as_missing << " " << r;
+      }
+    }
+  }
+}
+
+TEST(TestBlockPredictor, wide_model) {
+  // the dense rows of a block stay in kMaxBlockBytes
+  ASSERT_EQ(BlockPredictor::BlockRows(6), BlockPredictor::kBlockRows);
+  for (const int num_features : {10000, 1 << 20, 1 << 28}) {
+    const int rows = BlockPredictor::BlockRows(num_features);
+    ASSERT_GE(rows, 1);
+    if (rows > 1) {
+      ASSERT_LE(rows * num_features * sizeof(float),
+                BlockPredictor::kMaxBlockBytes);
+    }
+  }
+  // the model of 1M features predicts a row per block
+  std::string text = kXGBoostModel;
+  const std::string num_feature = R"("num_class": "0", "num_feature": "2")";
+  const size_t pos = text.find(num_feature);
+  ASSERT_NE(pos, std::string::npos);
+  text.replace(pos, num_feature.size(),
+               R"("num_class": "0", "num_feature": "1000000")");
+  const std::string fname = WriteTempFile("xgboost_wide_model.json", text);
+  const CSRMatrix<float> X = ImportTestData();
+  Vec<float> preds[2];
+  for (const std::string predictor : {"traversal", "block"}) {
+    BoostedTreeParam param;
+    param.predictor = predictor;
+    BoostedTree bst(param);
+    bst.load_xgboost_model(fname);
+    preds[predictor == "block"] = bst.predict(X);
+  }
+  ASSERT_EQ(preds[0].size(), X.length());
+  ASSERT_EQ(preds[1].size(), X.length());
+  for (int i = 0; i < X.length(); ++i) ASSERT_EQ(preds[0][i], preds[1][i]) << i;
+}
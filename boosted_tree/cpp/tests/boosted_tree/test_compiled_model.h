@@ -0,0 +1,33 @@
+#pragma once
+
+#include <boosted_tree/boosted_tree.h>
+#include <boosted_tree/compiled_model.h>
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "./test_tree_method.h"
+
+TEST(TestCompiledModel, predict) {
+  auto [X, Y] = GenBinaryData(1000);
+  for (const bool zero_as_missing : {false, true}) {
+    for (const std::string objective : {"reg:linear", "binary:logistic"}) {
+      BoostedTreeParam param;
+      param.objective = objective;
+      param.n_estimators = 10;
+      param.zero_as_missing = zero_as_missing;
+      BoostedTree bst(param);
+      bst.train(X, Y);
+      const std::string lib_path = testing::TempDir() + "boosted_tree_aot.so";
+      ASSERT_TRUE(CompiledModel::compile(bst.export_cpp(), lib_path));
+      CompiledModel model(lib_path);
+      const Vec<float> preds = bst.predict(X);
+      const Vec<float> compiled_preds = model.predict(X);
+      ASSERT_EQ(preds.size(), compiled_preds.size());
+      for (int i = 0; i < preds.size(); ++i) {
+        // the margins are the same, exp may differ in the last bit
+        ASSERT_FLOAT_EQ(preds[i], compiled_preds[i]) << objective << " " << i;
+      }
+    }
+  }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <boosted_tree/boosted_tree.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "./test_tree_method.h"
+
+TEST(TestModelFormat, save_and_load) {
+  auto [X, Y] = GenBinaryData(1000);
+  BoostedTreeParam param;
+  param.objective = "binary:logistic";
+  param.n_estimators = 10;
+  param.zero_as_missing = true;
+  BoostedTree bst(param);
+  bst.train(X, Y);
+  const Vec<float> preds = bst.predict(X);
+  const std::string fname = testing::TempDir() + "boosted_tree_model.bin";
+  bst.save_model(fname);
+  for (const std::string predictor :
+       {"traversal", "quickscorer", "block", "compact"}) {
+    // the objective and zero_as_missing are loaded from the model
+    BoostedTreeParam load_param;
+    load_param.predictor = predictor;
+    BoostedTree mapped(load_param), copied(load_param);
+    mapped.load_model(fname);
+    copied.load_raw(bst.save_raw());
+    ASSERT_EQ(bst.str(), mapped.str());
+    if (predictor == "traversal") {
+      ASSERT_EQ(bst.save_raw(), mapped.save_raw());
+    }
+    const Vec<float> mapped_preds = mapped.predict(X);
+    const Vec<float> copied_preds = copied.predict(X);
+    for (int i = 0; i < X.length(); ++i) {
+      ASSERT_EQ(preds[i], mapped_preds[i]) << predictor << " " << i;
+      ASSERT_EQ(preds[i], copied_preds[i]) << predictor << " " << i;
+    }
+  }
+}
+
+TEST(TestModelFormat, train_loaded_model) {
+  // training a loaded model of 5 trees gives the model trained with 10 trees
+  auto [X, Y] = GenBinaryData(1000);
+  BoostedTreeParam param;
+  param.objective = "binary:logistic";
+  param.n_estimators = 10;
+  param.tree_method = "hist";
+  BoostedTree full(param);
+  full.train(X, Y);
+  param.n_estimators = 5;
+  BoostedTree bst(param);
+  bst.train(X, Y);
+  const std::string fname = testing::TempDir() + "boosted_tree_model.bin";
+  bst.save_model(fname);
+  BoostedTree loaded(param);
+  loaded.load_model(fname);
+  loaded.train(X, Y);
+  ASSERT_EQ(full.str(), loaded.str());
+  const Vec<float> preds = full.predict(X);
+  const Vec<float> loaded_preds = loaded.predict(X);
+  for (int i = 0; i < X.length(); ++i) {
+    ASSERT_EQ(preds[i], loaded_preds[i]) << i;
+  }
+}
+
+TEST(TestModelFormat, load_bad_model) {
+  // 2 trees of 3 nodes {root, left, right}, the nodes are the last bytes
+  auto [X, Y] = GenBinaryData(1000);
+  BoostedTreeParam param;
+  param.objective = "binary:logistic";
+  param.n_estimators = 2;
+  param.max_depth = 1;
+  BoostedTree bst(param);
+  bst.train(X, Y);
+  const std::string buf = bst.save_raw();
+  const size_t node_size = 16, num_nodes = 6;
+  const size_t nodes_offset = buf.size() - num_nodes * node_size;
+  auto set_int32 = [](std::string *buf, const size_t offset,
+                      const int32_t value) {
+    std::memcpy(&(*buf)[offset], &value, sizeof(value));
+  };
+  const int32_t roots[2] = {0, 3};
+  const size_t trees_offset = buf.rfind(
+      std::string(reinterpret_cast<const char *>(roots), sizeof(roots)),
+      nodes_offset);
+  ASSERT_NE(trees_offset, std::string::npos);
+  {
+    BoostedTree loaded((BoostedTreeParam()));
+    loaded.load_raw(buf);
+    ASSERT_EQ(loaded.str(), bst.str());
+  }
+  std::vector<std::string> bad_bufs;
+  for (const int32_t left : {0, -1, 3}) {
+    // a cycle, out of the nodes, and out of the tree
+    bad_bufs.push_back(buf);
+    set_int32(&bad_bufs.back(), nodes_offset, left);
+  }
+  // the roots are not ascending
+  bad_bufs.push_back(buf);
+  set_int32(&bad_bufs.back(), trees_offset, 3);
+  set_int32(&bad_bufs.back(), trees_offset + 4, 0);
+  // the trees of a class are used in prediction by t % num_class
+  for (const std::string num_class : {"num_class 0\n", "num_class 3\n"}) {
+    bad_bufs.push_back(buf);
+    const size_t pos = bad_bufs.back().find("num_class 1\n");
+    ASSERT_NE(pos, std::string::npos);
+    bad_bufs.back().replace(pos, num_class.size(), num_class);
+  }
+  testing::FLAGS_gtest_death_test_style = "threadsafe";
+  for (size_t i = 0; i < bad_bufs.size(); ++i) {
+    BoostedTree loaded((BoostedTreeParam()));
+    // LOG(FATAL) exits with -1 and writes to stdout
+    ASSERT_EXIT(loaded.load_raw(bad_bufs[i]), testing::ExitedWithCode(255), "")
+        << i;
+  }
+}
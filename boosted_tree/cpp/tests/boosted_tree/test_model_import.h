@@ -0,0 +1,223 @@
+#pragma once
+
+#include <boosted_tree/boosted_tree.h>
+#include <boosted_tree/csr_matrix.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// tree 0: x0 < 0.5 (missing: left) ? 0.4 : (x1 < 1.5 ? -0.2 : 0.1)
+// tree 1: 0.05
+inline const char *kXGBoostModel = R"({
+  "learner": {
+    "attributes": {},
+    "feature_names": [],
+    "feature_types": [],
+    "gradient_booster": {
+      "model": {
+        "gbtree_model_param": {"num_parallel_tree": "1", "num_trees": "2"},
+        "tree_info": [0, 0],
+        "trees": [
+          {"base_weights": [0, 0.4, 0, -0.2, 0.1],
+           "categories": [], "categories_nodes": [],
+           "categories_segments": [], "categories_sizes": [],
+           "default_left": [1, 0, 0, 0, 0],
+           "id": 0,
+           "left_children": [1, -1, 3, -1, -1],
+           "loss_changes": [1.5, 0, 0.5, 0, 0],
+           "parents": [2147483647, 0, 0, 2, 2],
+           "right_children": [2, -1, 4, -1, -1],
+           "split_conditions": [5E-1, 4E-1, 1.5E0, -2E-1, 1E-1],
+           "split_indices": [0, 0, 1, 0, 0],
+           "split_type": [0, 0, 0, 0, 0],
+           "sum_hessian": [4, 1, 3, 1, 2],
+           "tree_param": {"num_deleted": "0", "num_feature": "2",
+                          "num_nodes": "5", "size_leaf_vector": "0"}},
+          {"base_weights": [5E-2],
+           "default_left": [false],
+           "id": 1,
+           "left_children": [-1],
+           "loss_changes": [0],
+           "parents": [2147483647],
+           "right_children": [-1],
+           "split_conditions": [5E-2],
+           "split_indices": [0],
+           "split_type": [0],
+           "sum_hessian": [4],
+           "tree_param": {"num_deleted": "0", "num_feature": "2",
+                          "num_nodes": "1", "size_leaf_vector": "0"}}
+        ]
+      },
+      "name": "gbtree"
+    },
+    "learner_model_param": {"base_score": "2.5E-1", "boost_from_average": "1",
+                            "num_class": "0", "num_feature": "2",
+                            "num_target": "1"},
+    "objective": {"name": "reg:squarederror",
+                  "reg_loss_param": {"scale_pos_weight": "1"}}
+  },
+  "version": [1, 7, 6]
+})";
+
+// tree 0: x0 <= 0.5 (missing: left) ? 0.4 : (x1 <= 1.5 ? -0.2 : 0.1), the
+// missing type of x1 is None, so NaN is zero and goes left
+// tree 1: 0.05
+inline const char *kLightGBMModel = R"(tree
+version=v3
+num_class=1
+num_tree_per_iteration=1
+label_index=0
+max_feature_idx=1
+objective=binary sigmoid:1
+feature_names=Column_0 Column_1
+feature_infos=[0:1] [0:3]
+tree_sizes=352 236
+
+Tree=0
+num_leaves=3
+num_cat=0
+split_feature=0 1
+split_gain=10 5
+threshold=0.50000000000000011 1.5000000000000002
+decision_type=10 2
+left_child=-1 -2
+right_child=1 -3
+leaf_value=0.40000000000000002 -0.20000000000000001 0.10000000000000001
+leaf_weight=1 1 1
+leaf_count=1 1 1
+internal_value=0 0
+internal_weight=0 0
+internal_count=3 2
+is_linear=0
+shrinkage=1
+
+
+Tree=1
+num_leaves=1
+num_cat=0
+split_feature=
+split_gain=
+threshold=
+decision_type=
+left_child=
+right_child=
+leaf_value=0.050000000000000003
+leaf_weight=
+leaf_count=
+internal_value=
+internal_weight=
+internal_count=
+is_linear=0
+shrinkage=1
+
+
+end of trees
+
+feature_importances:
+Column_0=1
+Column_1=1
+
+parameters:
+[boosting: gbdt]
+end of parameters
+)";
+
+// x0, x1 of the rows, NaN is missing
+inline CSRMatrix<float> ImportTestData() {
+  const float nan = BoostedTree::MISSING_VALUE;
+  const std::vector<std::vector<float>> rows{
+      {0.2, 1}, {nan, 2}, {1, nan}, {1, 1}, {0.5, 3}, {1, 1.5}, {1, 2}};
+  std::vector<dim_t> row, col;
+  std::vector<float> data;
+  for (size_t r = 0; r < rows.size(); ++r) {
+    for (int c = 0; c < 2; ++c) {
+      row.push_back(r);
+      col.push_back(c);
+      data.push_back(rows[r][c]);
+    }
+  }
+  CSRMatrix<float> X(rows.size(), 2);
+  X.reset(row, col, data);
+  return X;
+}
+
+inline std::string WriteTempFile(const std::string &name,
+                                 const std::string &text) {
+  const std::string fname = testing::TempDir() + name;
+  std::ofstream fout(fname);
+  fout << text;
+  return fname;
+}
+
+TEST(TestModelImport, xgboost) {
+  const std::string fname = WriteTempFile("xgboost_model.json", kXGBoostModel);
+  const CSRMatrix<float> X = ImportTestData();
+  // base_score + tree 0 + tree 1, x0 = 0.5 and x1 = 1.5 go right
+  const std::vector<float> tree0{0.4, 0.4, 0.1, -0.2, 0.1, 0.1, 0.1};
+  for (const std::string predictor :
+       {"traversal", "quickscorer", "block", "compact"}) {
+    BoostedTreeParam param;
+    param.predictor = predictor;
+    BoostedTree bst(param);
+    bst.load_xgboost_model(fname);
+    // the base margin is saved since version 2
+    BoostedTree loaded(param);
+    loaded.load_raw(bst.save_raw());
+    const Vec<float> preds = bst.predict(X);
+    const Vec<float> loaded_preds = loaded.predict(X);
+    for (size_t i = 0; i < tree0.size(); ++i) {
+      float expected = 0.25f;
+      expected += tree0[i];
+      expected += 0.05f;
+      ASSERT_EQ(preds[i], expected) << predictor << " " << i;
+      ASSERT_EQ(loaded_preds[i], expected) << predictor << " " << i;
+    }
+  }
+}
+
+TEST(TestModelImport, xgboost_bad_tree) {
+  // node 2 is its own child, or the child of node 2 is reached twice
+  testing::FLAGS_gtest_death_test_style = "threadsafe";
+  const std::string good_children =
+      R"("left_children": [1, -1, 3, -1, -1],
+           "loss_changes": [1.5, 0, 0.5, 0, 0],
+           "parents": [2147483647, 0, 0, 2, 2],
+           "right_children": [2, -1, 4, -1, -1],)";
+  const std::string bad_children[] = {
+      R"("left_children": [1, -1, 2, -1, -1],
+           "loss_changes": [1.5, 0, 0.5, 0, 0],
+           "parents": [2147483647, 0, 0, 2, 2],
+           "right_children": [2, -1, 2, -1, -1],)",
+      R"("left_children": [1, -1, 3, -1, -1],
+           "loss_changes": [1.5, 0, 0.5, 0, 0],
+           "parents": [2147483647, 0, 0, 2, 2],
+           "right_children": [2, -1, 3, -1, -1],)"};
+  for (const std::string &children : bad_children) {
+    std::string text = kXGBoostModel;
+    const size_t pos = text.find(good_children);
+    ASSERT_NE(pos, std::string::npos);
+    text.replace(pos, good_children.size(), children);
+    const std::string fname = WriteTempFile("xgboost_bad_model.json", text);
+    BoostedTree bst((BoostedTreeParam()));
+    // LOG(FATAL) exits with -1 and writes to stdout
+    ASSERT_EXIT(bst.load_xgboost_model(fname), testing::ExitedWithCode(255),
+                "");
+  }
+}
+
+TEST(TestModelImport, lightgbm) {
+  const std::string fname = WriteTempFile("lightgbm_model.txt", kLightGBMModel);
+  const CSRMatrix<float> X = ImportTestData();
+  // x0 = 0.5 and x1 = 1.5 are equal to the thresholds and go left
+  const std::vector<float> tree0{0.4, 0.4, -0.2, -0.2, 0.4, -0.2, 0.1};
+  BoostedTree bst((BoostedTreeParam()));
+  bst.load_lightgbm_model(fname);
+  const Vec<float> preds = bst.predict(X);
+  for (size_t i = 0; i < tree0.size(); ++i) {
+    const float margin = tree0[i] + 0.05f;
+    ASSERT_FLOAT_EQ(preds[i], 1.0f / (1.0f + std::exp(-margin))) << i;
+  }
+}
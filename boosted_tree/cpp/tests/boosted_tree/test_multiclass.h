@@ -0,0 +1,146 @@
+#pragma once
+
+#include <boosted_tree/boosted_tree.h>
+#include <boosted_tree/objective.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+// y = argmax(x0, x1, x2 + x3), x3 has missing values
+inline std::pair<CSRMatrix<float>, Vec<float>> GenMultiClassData(
+    const int rows, const int seed = 0) {
+  std::vector<dim_t> row, col;
+  std::vector<float> data;
+  std::vector<float> labels(rows);
+  srand(seed);
+  auto uniform = []() { return float(rand() % 2000) / 1000 - 1; };
+  for (int r = 0; r < rows; ++r) {
+    float x[4];
+    for (int c = 0; c < 3; ++c) x[c] = uniform();
+    const bool missing = rand() % 4 == 0;
+    x[3] = missing ? BoostedTree::MISSING_VALUE : uniform();
+    const float s[3] = {x[0], x[1], x[2] + (missing ? 0 : x[3])};
+    labels[r] = std::max_element(s, s + 3) - s;
+    for (int c = 0; c < 4; ++c) {
+      if (x[c] != 0) {
+        row.push_back(r);
+        col.push_back(c);
+        data.push_back(x[c]);
+      }
+    }
+  }
+  CSRMatrix<float> X(rows, 4);
+  X.reset(row, col, data);
+  return {X, labels};
+}
+
+TEST(TestMultiClass, softmax_gradient) {
+  // the gradients of a row sum to 0, and match the finite differences
+  Objective<float> *objective =
+      Registry<Objective<float>>::Find("multi:softprob");
+  ASSERT_TRUE(objective != nullptr);
+  ASSERT_TRUE(objective->multiclass());
+  const int num_class = 4;
+  const float x[num_class] = {0.5, -1.0, 2.0, 0.25};
+  const float y = 2;
+  GradientInfo out[num_class];
+  objective->gradient_hessian_multi(x, &y, out, 1, num_class);
+  float sum = 0;
+  for (int k = 0; k < num_class; ++k) {
+    sum += out[k].gradient;
+    float xp[num_class], xm[num_class];
+    std::copy(x, x + num_class, xp);
+    std::copy(x, x + num_class, xm);
+    const float h = 1e-2;
+    xp[k] += h;
+    xm[k] -= h;
+    const float diff = (objective->compute_multi(xp, y, num_class) -
+                        objective->compute_multi(xm, y, num_class)) /
+                       (2 * h);
+    ASSERT_NEAR(out[k].gradient, diff, 1e-3) << k;
+    ASSERT_GT(out[k].hessian, 0) << k;
+  }
+  ASSERT_NEAR(sum, 0, 1e-6);
+}
+
+TEST(TestMultiClass, softprob) {
+  auto [X, Y] = GenMultiClassData(1000);
+  auto [X2, Y2] = GenMultiClassData(500, 1);
+  const int num_class = 3;
+  for (const std::string tree_method : {"exact", "hist"}) {
+    std::vector<Vec<float>> probs;
+    for (const std::string predictor :
+         {"traversal", "quickscorer", "block", "compact"}) {
+      BoostedTreeParam param;
+      param.objective = "multi:softprob";
+      param.num_class = num_class;
+      param.n_estimators = 10;
+      param.tree_method = tree_method;
+      param.predictor = predictor;
+      BoostedTree bst(param);
+      bst.train(X, Y);
+      ASSERT_EQ(NumTrees(bst), 10 * num_class);
+      probs.push_back(bst.predict(X2));
+    }
+    // the same predictions as the traversal
+    for (int p = 1; p < probs.size(); ++p) {
+      ASSERT_EQ(probs[p].size(), X2.length() * num_class);
+      for (int i = 0; i < probs[0].size(); ++i) {
+        ASSERT_EQ(probs[0][i], probs[p][i]) << p << " " << i;
+      }
+    }
+    int right = 0;
+    for (int i = 0; i < X2.length(); ++i) {
+      const float *prob = &probs[0][i * num_class];
+      ASSERT_NEAR(prob[0] + prob[1] + prob[2], 1, 1e-5) << i;
+      right += std::max_element(prob, prob + num_class) - prob == Y2[i];
+    }
+    ASSERT_GT(right, X2.length() * 0.85) << tree_method;
+  }
+}
+
+TEST(TestMultiClass, softmax) {
+  auto [X, Y] = GenMultiClassData(1000);
+  const int num_class = 3;
+  BoostedTreeParam param;
+  param.objective = "multi:softprob";
+  param.num_class = num_class;
+  param.n_estimators = 10;
+  param.tree_method = "hist";
+  BoostedTree softprob(param);
+  softprob.train(X, Y, {{X, Y}});
+  param.objective = "multi:softmax";
+  BoostedTree softmax(param);
+  softmax.train(X, Y);
+  const Vec<float> probs = softprob.predict(X);
+  const Vec<float> labels = softmax.predict(X);
+  ASSERT_EQ(softprob.num_outputs(), num_class);
+  ASSERT_EQ(softmax.num_outputs(), 1);
+  ASSERT_EQ(probs.size(), X.length() * num_class);
+  ASSERT_EQ(labels.size(), X.length());
+  for (int i = 0; i < X.length(); ++i) {
+    const float *prob = &probs[i * num_class];
+    ASSERT_EQ(labels[i], std::max_element(prob, prob + num_class) - prob)
+        << i;
+  }
+
+  // num_class is saved, and the staged margins are per class
+  BoostedTree loaded((BoostedTreeParam()));
+  loaded.load_raw(softprob.save_raw());
+  ASSERT_EQ(loaded.num_outputs(), num_class);
+  const Vec<float> loaded_probs = loaded.predict(X);
+  ASSERT_EQ(loaded_probs.size(), probs.size());
+  for (int i = 0; i < probs.size(); ++i) ASSERT_EQ(probs[i], loaded_probs[i]);
+  for (const int num_trees : {num_class, 4 * num_class, 10 * num_class}) {
+    const Vec<float> preds = loaded.predict(X, 0, num_trees);
+    const Vec<float> staged = loaded.predict_staged(X, num_trees);
+    for (int i = 0; i < probs.size(); ++i) {
+      ASSERT_EQ(preds[i], staged[i]) << num_trees << " " << i;
+      if (num_trees == 10 * num_class) ASSERT_EQ(preds[i], probs[i]) << i;
+    }
+  }
+}
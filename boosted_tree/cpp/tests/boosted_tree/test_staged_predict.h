@@ -0,0 +1,96 @@
+#pragma once
+
+#include <boosted_tree/boosted_tree.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <string>
+
+#include "./test_tree_method.h"
+
+TEST(TestStagedPredict, tree_range) {
+  auto [X, Y] = GenBinaryData(1000);
+  BoostedTreeParam param;
+  param.objective = "reg:linear";
+  param.n_estimators = 10;
+  param.tree_method = "hist";
+  BoostedTree bst(param);
+  bst.train(X, Y);
+  const Vec<float> preds = bst.predict(X);
+  const Vec<float> all_preds = bst.predict(X, 0, 10);
+  const Vec<float> none_preds = bst.predict(X, 0, 0);
+  const Vec<float> head_preds = bst.predict(X, 0, 4);
+  const Vec<float> tail_preds = bst.predict(X, 4, 10);
+  for (int i = 0; i < X.length(); ++i) {
+    ASSERT_EQ(preds[i], all_preds[i]) << i;
+    // the base margin is added to every range
+    ASSERT_EQ(none_preds[i], 0) << i;
+    ASSERT_NEAR(head_preds[i] + tail_preds[i], preds[i], 1e-5) << i;
+  }
+}
+
+TEST(TestStagedPredict, margin_cache) {
+  auto [X, Y] = GenBinaryData(1000);
+  auto [X2, Y2] = GenBinaryData(300, 1);
+  BoostedTreeParam param;
+  param.objective = "binary:logistic";
+  param.n_estimators = 10;
+  param.tree_method = "hist";
+  BoostedTree bst(param);
+  bst.train(X, Y);
+  // the prefixes grow, then shrink
+  for (const int k : {1, 2, 5, 10, 3, 10}) {
+    const Vec<float> preds = bst.predict(X, 0, k);
+    const Vec<float> staged = bst.predict_staged(X, k);
+    const Vec<float> preds2 = bst.predict(X2, 0, k);
+    const Vec<float> staged2 = bst.predict_staged(X2, k);
+    for (int i = 0; i < X.length(); ++i) ASSERT_EQ(preds[i], staged[i]) << k;
+    for (int i = 0; i < X2.length(); ++i) {
+      ASSERT_EQ(preds2[i], staged2[i]) << k;
+    }
+  }
+  const Vec<float> preds = bst.predict(X);
+  const Vec<float> staged = bst.predict_staged(X);
+  for (int i = 0; i < X.length(); ++i) ASSERT_EQ(preds[i], staged[i]) << i;
+
+  // a matrix of the same height doesn't use the margins of X, and a copy
+  // of X shares them
+  auto [X3, Y3] = GenBinaryData(1000, 3);
+  const Vec<float> preds3 = bst.predict(X3);
+  const Vec<float> staged3 = bst.predict_staged(X3);
+  for (int i = 0; i < X3.length(); ++i) ASSERT_EQ(preds3[i], staged3[i]) << i;
+  const CSRMatrix<float> X_copy = X;
+  const Vec<float> staged_copy = bst.predict_staged(X_copy);
+  for (int i = 0; i < X.length(); ++i) {
+    ASSERT_EQ(preds[i], staged_copy[i]) << i;
+  }
+
+  // the caches are cleared by a new model
+  param.n_estimators = 3;
+  param.max_depth = 2;
+  BoostedTree other(param);
+  other.train(X, Y);
+  bst.load_raw(other.save_raw());
+  const Vec<float> new_preds = bst.predict(X);
+  const Vec<float> new_staged = bst.predict_staged(X);
+  for (int i = 0; i < X.length(); ++i) {
+    ASSERT_EQ(new_preds[i], new_staged[i]) << i;
+  }
+}
+
+TEST(TestStagedPredict, predict_label) {
+  auto [X, Y] = GenBinaryData(1000);
+  BoostedTreeParam param;
+  param.objective = "binary:logistic";
+  param.n_estimators = 40;
+  param.tree_method = "hist";
+  BoostedTree bst(param);
+  bst.train(X, Y);
+  const Vec<float> preds = bst.predict(X);
+  for (const float threshold : {0.1f, 0.5f, 0.9f}) {
+    const Vec<float> labels = bst.predict_label(X, threshold);
+    for (int i = 0; i < X.length(); ++i) {
+      ASSERT_EQ(labels[i], preds[i] >= threshold) << threshold << " " << i;
+    }
+  }
+}
@@ -0,0 +1,573 @@
+#pragma once
+
+#include <boosted_tree/boosted_tree.h>
+#include <boosted_tree/csr_matrix.h>
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// y = (x0 + x1 * x2 > 0), x3 is sparse noise, x4 has missing values
+inline std::pair<CSRMatrix<float>, Vec<float>> GenBinaryData(
+    const int rows, const int seed = 0) {
+  std::vector<dim_t> row, col;
+  std::vector<float> data;
+  std::vector<float> labels(rows);
+  srand(seed);
+  auto uniform = []() { return float(rand() % 2000) / 1000 - 1; };
+  for (int r = 0; r < rows; ++r) {
+    float x[5];
+    for (int c = 0; c < 3; ++c) x[c] = uniform();
+    x[3] = rand() % 10 == 0 ? uniform() : 0;
+    x[4] = rand() % 4 == 0 ? BoostedTree::MISSING_VALUE : uniform();
+    labels[r] = x[0] + x[1] * x[2] > 0;
+    for (int c = 0; c < 5; ++c) {
+      if (x[c] != 0) {
+        row.push_back(r);
+        col.push_back(c);
+        data.push_back(x[c]);
+      }
+    }
+  }
+  CSRMatrix<float> X(rows, 5);
+  X.reset(row, col, data);
+  return {X, labels};
+}
+
+// GenBinaryData with 5% of the labels flipped
+inline std::pair<CSRMatrix<float>, Vec<float>> GenNoisyBinaryData(
+    const int rows, const int seed = 0) {
+  auto data = GenBinaryData(rows, seed);
+  Vec<float> &labels = data.second;
+  for (int r = 0; r < rows; ++r) {
+    if (rand() % 20 == 0) labels[r] = 1 - labels[r];
+  }
+  return data;
+}
+
+// y = (x0 + x1 * x2 > 0), every entry is stored
+inline std::pair<CSRMatrix<float>, Vec<float>> GenDenseBinaryData(
+    const int rows, const int seed = 0) {
+  std::vector<dim_t> row, col;
+  std::vector<float> data;
+  std::vector<float> labels(rows);
+  srand(seed);
+  for (int r = 0; r < rows; ++r) {
+    float x[3];
+    for (int c = 0; c < 3; ++c) {
+      x[c] = float(rand() % 2000 + 1) / 1000 - 1.0005;
+      row.push_back(r);
+      col.push_back(c);
+      data.push_back(x[c]);
+    }
+    labels[r] = x[0] + x[1] * x[2] > 0;
+  }
+  CSRMatrix<float> X(rows, 3);
+  X.reset(row, col, data);
+  return {X, labels};
+}
+
+inline int NumTrees(const BoostedTree &bst) {
+  const std::string s = bst.str();
+  int num_trees = 0;
+  for (size_t p = s.find("Tree "); p != std::string::npos;
+       p = s.find("Tree ", p + 1)) {
+    ++num_trees;
+  }
+  return num_trees;
+}
+
+inline int NumLeaves(const BoostedTree &bst) {
+  const std::string s = bst.str();
+  int num_leaves = 0;
+  for (size_t p = s.find("predict:"); p != std::string::npos;
+       p = s.find("predict:", p + 1)) {
+    ++num_leaves;
+  }
+  return num_leaves;
+}
+
+inline float TrainingAccuracy(const BoostedTreeParam &param) {
+  auto [X, Y] = GenBinaryData(1000);
+  BoostedTree bst(param);
+  bst.train(X, Y);
+  Vec<float> preds = bst.predict(X);
+  int right = 0;
+  for (int i = 0; i < Y.size(); ++i) {
+    if ((preds[i] >= 0.5) == (Y[i] >= 0.5)) ++right;
+  }
+  return float(right) / Y.size();
+}
+
+TEST(TestBoostedTree, tree_method) {
+  for (const std::string method : {"exact", "approx", "hist"}) {
+    BoostedTreeParam param;
+    param.objective = "binary:logistic";
+    param.n_estimators = 10;
+    param.tree_method = method;
+    ASSERT_GE(TrainingAccuracy(param), 0.95) << method;
+  }
+}
+
+TEST(TestBoostedTree, gradient_pairs) {
+  // the predictions of the model trained before the gradient pairs were
+  // computed once per round, up to the approximated sigmoid
+  auto [X, Y] = GenDenseBinaryData(200);
+  BoostedTreeParam param;
+  param.objective = "binary:logistic";
+  param.n_estimators = 2;
+  param.max_depth = 2;
+  param.tree_method = "exact";
+  BoostedTree bst(param);
+  bst.train(X, Y);
+  const std::vector<float> expected{0.714608133, 0.370368302, 0.714608133,
+                                    0.620589852, 0.290767103, 0.714608133,
+                                    0.714608133, 0.714608133};
+  const Vec<float> preds = bst.predict(X);
+  for (size_t i = 0; i < expected.size(); ++i) {
+    ASSERT_NEAR(preds[i], expected[i], 1e-6) << i;
+  }
+}
+
+TEST(TestBoostedTree, depthwise_levels) {
+  // the predictions of the models grown node by node before the levels were
+  // expanded together
+  auto [X, Y] = GenDenseBinaryData(200);
+  const std::vector<float> expected{0.651973426, 0.102203563, 0.651973426,
+                                    0.651973426, 0.0119010061, 0.651973426,
+                                    0.599852979, 0.651973426};
+  for (const std::string method : {"approx", "hist"}) {
+    BoostedTreeParam param;
+    param.n_estimators = 3;
+    param.max_depth = 3;
+    param.tree_method = method;
+    BoostedTree bst(param);
+    bst.train(X, Y);
+    const Vec<float> preds = bst.predict(X);
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ASSERT_EQ(preds[i], expected[i]) << method << " " << i;
+    }
+  }
+}
+
+TEST(TestBoostedTree, packed_nodes) {
+  // the model grown by lossguide before the nodes were packed into an array
+  auto [X, Y] = GenDenseBinaryData(200);
+  BoostedTreeParam param;
+  param.n_estimators = 2;
+  param.tree_method = "exact";
+  param.grow_policy = "lossguide";
+  param.max_depth = 0;
+  param.max_leaves = 5;
+  BoostedTree bst(param);
+  bst.train(X, Y);
+  const std::string expected =
+      "Tree 1:\n"
+      "\tf0 < 0.1255\n"
+      "\t\tf0 < -0.293\n"
+      "\t\t\tf2 < 0.885\n"
+      "\t\t\t\tpredict: 0.00451128\n"
+      "\t\t\tf2 >= 0.885 or missing\n"
+      "\t\t\t\tpredict: 0.133333\n"
+      "\t\tf0 >= -0.293 or missing\n"
+      "\t\t\tpredict: 0.104348\n"
+      "\tf0 >= 0.1255 or missing\n"
+      "\t\tf2 < -0.9825\n"
+      "\t\t\tpredict: -0\n"
+      "\t\tf2 >= -0.9825 or missing\n"
+      "\t\t\tpredict: 0.285714\n"
+      "Tree 2:\n"
+      "\tf0 < -0.00800002\n"
+      "\t\tf1 < 0.707\n"
+      "\t\t\tpredict: 0.00976945\n"
+      "\t\tf1 >= 0.707 or missing\n"
+      "\t\t\tf2 < 0.299\n"
+      "\t\t\t\tpredict: -0.0126988\n"
+      "\t\t\tf2 >= 0.299 or missing\n"
+      "\t\t\t\tpredict: 0.212457\n"
+      "\tf0 >= -0.00800002 or missing\n"
+      "\t\tf2 < -0.9825\n"
+      "\t\t\tpredict: -0\n"
+      "\t\tf2 >= -0.9825 or missing\n"
+      "\t\t\tpredict: 0.194073\n";
+  ASSERT_EQ(bst.str(), expected);
+}
+
+TEST(TestBoostedTree, sorted_columns) {
+  // "exact" scans the pre-sorted columns for the large nodes, and "auto"
+  // sorts the samples of every node no larger than
+  // TREE_METHOD_APPROX_RATIO / sketch_eps rows, they find the same splits
+  const int rows = 3000;
+  CSRMatrix<float> dense(rows, 3);
+  {
+    std::vector<dim_t> row, col;
+    std::vector<float> data;
+    srand(7);
+    for (int r = 0; r < rows; ++r) {
+      for (int c = 0; c < 3; ++c) {
+        row.push_back(r);
+        col.push_back(c);
+        data.push_back(float(rand() % 2000 + 1) / 1000 - 1.0005);
+      }
+    }
+    dense.reset(row, col, data);
+  }
+  auto [sparse, Y] = GenBinaryData(rows);
+  for (const bool is_dense : {true, false}) {
+    const CSRMatrix<float> &X = is_dense ? dense : sparse;
+    for (const bool zero_as_missing : {false, true}) {
+      std::string models[2];
+      Vec<float> preds[2];
+      for (const std::string method : {"exact", "auto"}) {
+        BoostedTreeParam param;
+        param.objective = "binary:logistic";
+        param.n_estimators = 5;
+        param.tree_method = method;
+        param.zero_as_missing = zero_as_missing;
+        BoostedTree bst(param);
+        bst.train(X, Y);
+        models[method == "auto"] = bst.str();
+        preds[method == "auto"] = bst.predict(X);
+      }
+      ASSERT_EQ(models[0], models[1]) << is_dense << " " << zero_as_missing;
+      for (int i = 0; i < rows; ++i) {
+        ASSERT_EQ(preds[0][i], preds[1][i])
+            << is_dense << " " << zero_as_missing << " " << i;
+      }
+    }
+  }
+}
+
+TEST(TestBoostedTree, hist_max_bin) {
+  for (const int max_bin : {2, 16, 1000}) {
+    BoostedTreeParam param;
+    param.objective = "binary:logistic";
+    param.n_estimators = 10;
+    param.tree_method = "hist";
+    param.max_bin = max_bin;
+    ASSERT_GE(TrainingAccuracy(param), max_bin == 2 ? 0.6 : 0.95) << max_bin;
+  }
+}
+
+TEST(TestBoostedTree, hist_cache) {
+  // the evicted histograms are built again
+  for (const int capacity : {3, 256}) {
+    BoostedTreeParam param;
+    param.objective = "binary:logistic";
+    param.n_estimators = 10;
+    param.max_depth = 8;
+    param.tree_method = "hist";
+    param.max_cached_hist_node = capacity;
+    ASSERT_GE(TrainingAccuracy(param), 0.95) << capacity;
+  }
+}
+
+TEST(TestBoostedTree, lossguide) {
+  auto [X, Y] = GenBinaryData(1000);
+  for (const std::string method : {"exact", "approx", "hist"}) {
+    BoostedTreeParam param;
+    param.objective = "binary:logistic";
+    param.n_estimators = 10;
+    param.tree_method = method;
+    param.grow_policy = "lossguide";
+    param.max_depth = 0;
+    param.max_leaves = 8;
+    ASSERT_GE(TrainingAccuracy(param), 0.9) << method;
+    BoostedTree bst(param);
+    bst.train(X, Y);
+    ASSERT_LE(NumLeaves(bst), param.n_estimators * param.max_leaves);
+  }
+}
+
+TEST(TestBoostedTree, colsample) {
+  auto [X, Y] = GenBinaryData(1000);
+  for (const std::string method : {"exact", "approx", "hist"}) {
+    BoostedTreeParam param;
+    param.objective = "binary:logistic";
+    param.n_estimators = 20;
+    param.tree_method = method;
+    param.colsample_bylevel = 0.8;
+    param.colsample_bynode = 0.8;
+    ASSERT_GE(TrainingAccuracy(param), 0.9) << method;
+    // a tree uses one of the 5 features
+    param.colsample_bylevel = param.colsample_bynode = 1;
+    param.colsample_bytree = 0.2;
+    BoostedTree bst(param);
+    bst.train(X, Y);
+    std::stringstream ss(bst.str());
+    std::string line;
+    std::set<std::string> features;
+    while (std::getline(ss, line)) {
+      if (line.rfind("Tree ", 0) == 0) {
+        ASSERT_LE(features.size(), 1) << method;
+        features.clear();
+      }
+      const size_t p = line.find('f');
+      if (p != std::string::npos) {
+        features.insert(line.substr(p, line.find(' ', p) - p));
+      }
+    }
+    ASSERT_LE(features.size(), 1) << method;
+  }
+}
+
+TEST(TestBoostedTree, row_sampling) {
+  for (const std::string method : {"exact", "approx", "hist"}) {
+    BoostedTreeParam param;
+    param.objective = "binary:logistic";
+    param.n_estimators = 20;
+    param.tree_method = method;
+    param.subsample = 0.5;
+    ASSERT_GE(TrainingAccuracy(param), 0.9) << method;
+    param.subsample = 1;
+    param.sampling_method = "goss";
+    param.top_rate = 0.2;
+    param.other_rate = 0.2;
+    ASSERT_GE(TrainingAccuracy(param), 0.9) << method;
+  }
+}
+
+TEST(TestBoostedTree, hist_empty_bin) {
+  // x0 is sparse, and the default bin of a child which has no zero keeps the
+  // rounding residue of total - the other bins, which isn't a split point.
+  // Without reg_lambda the residue may have the largest gain, and the node
+  // would become a leaf rather than be split by x1
+  const int rows = 5000;
+  std::vector<dim_t> row, col;
+  std::vector<float> data;
+  std::vector<float> labels(rows);
+  srand(5);
+  for (int r = 0; r < rows; ++r) {
+    const float x0 =
+        rand() % 5 == 0 ? (rand() % 2 ? 1 : -1) * (1 + rand() % 3) : 0;
+    const float x1 = float(rand() % 1000) / 1000;
+    labels[r] = (x0 > 0) + x1 + float(rand() % 1000) / 10000;
+    if (x0 != 0) {
+      row.push_back(r);
+      col.push_back(0);
+      data.push_back(x0);
+    }
+    row.push_back(r);
+    col.push_back(1);
+    data.push_back(x1);
+  }
+  CSRMatrix<float> X(rows, 2);
+  X.reset(row, col, data);
+  BoostedTreeParam param;
+  param.objective = "reg:linear";
+  param.n_estimators = 10;
+  param.max_depth = 4;
+  param.tree_method = "hist";
+  param.reg_lambda = 0;
+  param.n_jobs = 4;
+  BoostedTree bst(param);
+  bst.train(X, labels);
+  // the gradients of the samples differ, so every node is split
+  ASSERT_EQ(NumLeaves(bst), param.n_estimators * (1 << param.max_depth));
+}
+
+TEST(TestBoostedTree, hist_bundle) {
+  // two one-hot encoded categorical features with 20 categories
+  const int rows = 1000;
+  std::vector<dim_t> row, col;
+  std::vector<float> data;
+  std::vector<float> labels(rows);
+  srand(4);
+  for (int r = 0; r < rows; ++r) {
+    const int a = rand() % 20, b = rand() % 20;
+    labels[r] = a == 3 || b == 7;
+    for (const int c : {a, 20 + b}) {
+      row.push_back(r);
+      col.push_back(c);
+      data.push_back(1);
+    }
+  }
+  CSRMatrix<float> X(rows, 40);
+  X.reset(row, col, data);
+  // the exclusive features are bundled without changing the model
+  std::string models[2];
+  for (const bool enable_bundle : {false, true}) {
+    BoostedTreeParam param;
+    param.objective = "binary:logistic";
+    param.n_estimators = 10;
+    param.tree_method = "hist";
+    param.enable_bundle = enable_bundle;
+    BoostedTree bst(param);
+    bst.train(X, labels);
+    models[enable_bundle] = bst.str();
+    Vec<float> preds = bst.predict(X);
+    for (int i = 0; i < rows; ++i) {
+      ASSERT_EQ(preds[i] >= 0.5, labels[i] >= 0.5) << enable_bundle << " " << i;
+    }
+  }
+  ASSERT_EQ(models[0], models[1]);
+}
+
+TEST(TestBoostedTree, n_jobs) {
+  // the model doesn't depend on the number of threads
+  auto [X, Y] = GenBinaryData(1000);
+  for (const std::string method : {"exact", "approx", "hist"}) {
+    std::string models[2];
+    for (const int n_jobs : {1, 4}) {
+      BoostedTreeParam param;
+      param.objective = "binary:logistic";
+      param.n_estimators = 5;
+      param.tree_method = method;
+      param.subsample = 0.8;
+      param.colsample_bynode = 0.8;
+      param.n_jobs = n_jobs;
+      BoostedTree bst(param);
+      bst.train(X, Y);
+      models[n_jobs > 1] = bst.str();
+    }
+    ASSERT_EQ(models[0], models[1]) << method;
+  }
+}
+
+TEST(TestBoostedTree, parallel_partition) {
+  // lossguide splits a node at a time, and the nodes of more than
+  // RowPartitioner::kMinBlockRows * 2 rows are partitioned by the threads
+  auto [X, Y] = GenBinaryData(20000);
+  for (const std::string method : {"exact", "approx", "hist"}) {
+    std::string models[2];
+    for (const int n_jobs : {1, 4}) {
+      BoostedTreeParam param;
+      param.objective = "binary:logistic";
+      param.n_estimators = 3;
+      param.tree_method = method;
+      param.grow_policy = "lossguide";
+      param.max_depth = 0;
+      param.max_leaves = 16;
+      param.n_jobs = n_jobs;
+      BoostedTree bst(param);
+      bst.train(X, Y);
+      models[n_jobs > 1] = bst.str();
+    }
+    ASSERT_EQ(models[0], models[1]) << method;
+  }
+}
+
+TEST(TestBoostedTree, early_stopping) {
+  auto [X, Y] = GenNoisyBinaryData(1000);
+  std::vector<BoostedTree::EvalData> eval_set{GenNoisyBinaryData(500, 2)};
+  BoostedTreeParam param;
+  param.objective = "binary:logistic";
+  param.n_estimators = 200;
+  param.max_depth = 8;
+  param.tree_method = "hist";
+  param.early_stopping_rounds = 3;
+  BoostedTree bst(param);
+  bst.train(X, Y, eval_set);
+  const int num_trees = NumTrees(bst);
+  ASSERT_GT(num_trees, 0);
+  ASSERT_LT(num_trees, param.n_estimators);
+  // training again only drops the new trees after the best iteration
+  const std::string model = bst.str();
+  bst.train(X, Y, eval_set);
+  ASSERT_GT(NumTrees(bst), num_trees);
+  ASSERT_EQ(bst.str().substr(0, model.size()), model);
+}
+
+TEST(TestBoostedTree, predict_rows) {
+  // the prediction of a row doesn't depend on the rows predicted before it,
+  // and the features unseen in training are ignored
+  auto [X, Y] = GenBinaryData(1000);
+  BoostedTreeParam param;
+  param.objective = "binary:logistic";
+  param.n_estimators = 10;
+  BoostedTree bst(param);
+  bst.train(X, Y);
+  const Vec<float> preds = bst.predict(X);
+  const int rows = 300;
+  std::vector<dim_t> row, col;
+  std::vector<float> data;
+  for (int r = 0; r < rows; ++r) {
+    for (int c = 0; c < 7; ++c) {
+      const float v = X[r][c];
+      // store every entry, including the zeros and the missing values
+      row.push_back(r);
+      col.push_back(c);
+      data.push_back(c < 5 ? v : 1);
+    }
+  }
+  CSRMatrix<float> X2(rows, 7);
+  X2.reset(row, col, data);
+  const Vec<float> preds2 = bst.predict(X2);
+  for (int i = 0; i < rows; ++i) ASSERT_EQ(preds[i], preds2[i]) << i;
+  const Vec<float> preds3 = bst.predict(X);
+  for (int i = 0; i < X.length(); ++i) ASSERT_EQ(preds[i], preds3[i]) << i;
+}
+
+TEST(TestBoostedTree, predictor) {
+  // the same predictions as the traversal, the trees with more than 64
+  // leaves are traversed by "quickscorer", and the rows which don't fill
+  // the SIMD lanes are traversed by "block", and "compact" compares the bins
+  // of the thresholds
+  auto [X, Y] = GenBinaryData(1000);
+  for (const bool zero_as_missing : {false, true}) {
+    for (const int max_depth : {4, 8}) {
+      std::vector<Vec<float>> preds;
+      for (const std::string predictor :
+           {"traversal", "quickscorer", "block", "compact"}) {
+        BoostedTreeParam param;
+        param.objective = "binary:logistic";
+        param.n_estimators = 10;
+        param.max_depth = max_depth;
+        param.tree_method = "hist";
+        param.zero_as_missing = zero_as_missing;
+        param.predictor = predictor;
+        BoostedTree bst(param);
+        bst.train(X, Y);
+        preds.push_back(bst.predict(X));
+      }
+      for (int p = 1; p < preds.size(); ++p) {
+        for (int i = 0; i < X.length(); ++i) {
+          ASSERT_EQ(preds[0][i], preds[p][i]) << p << " " << max_depth << " "
+                                              << i;
+        }
+      }
+    }
+  }
+}
+
+TEST(TestBoostedTree, sparse_feature) {
+  // y = (x0 >= 0), only 20% of x0 are stored, the others are zero
+  const int rows = 1000;
+  std::vector<dim_t> row, col;
+  std::vector<float> data;
+  std::vector<float> labels(rows);
+  srand(3);
+  for (int r = 0; r < rows; ++r) {
+    float x = 0;
+    if (rand() % 5 == 0) x = float(rand() % 2000 + 1) / 1000 - 1.0005;
+    labels[r] = x >= 0;
+    if (x != 0) {
+      row.push_back(r);
+      col.push_back(0);
+      data.push_back(x);
+    }
+  }
+  CSRMatrix<float> X(rows, 1);
+  X.reset(row, col, data);
+  for (const bool zero_as_missing : {false, true}) {
+    for (const std::string method : {"exact", "approx", "hist"}) {
+      BoostedTreeParam param;
+      param.objective = "binary:logistic";
+      param.n_estimators = 5;
+      param.max_depth = 2;
+      param.tree_method = method;
+      param.zero_as_missing = zero_as_missing;
+      BoostedTree bst(param);
+      bst.train(X, labels);
+      Vec<float> preds = bst.predict(X);
+      for (int i = 0; i < rows; ++i) {
+        ASSERT_EQ(preds[i] >= 0.5, labels[i] >= 0.5)
+            << method << " " << zero_as_missing << " " << i;
+      }
+    }
+  }
+}
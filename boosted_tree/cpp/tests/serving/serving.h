@@ -0,0 +1,3 @@
+#pragma once
+#include "test_micro_batcher.h"
+#include "test_socket.h"
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <boosted_tree/csr_matrix.h>
+#include <boosted_tree/vec.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../../src/serving/micro_batcher.h"
+
+// the prediction of a row is the sum of its values, and the size of every
+// batch is recorded
+class SumPredictor {
+ public:
+  Vec<float> operator()(const CSRMatrix<float> &X) {
+    const dim_t rows = X.length();
+    Vec<float> preds(rows);
+    for (dim_t r = 0; r < rows; ++r) {
+      const CSRRow<float> row = X[r];
+      float sum = 0;
+      for (dim_t k = 0; k < row.nnz(); ++k) sum += row.values()[k];
+      preds[r] = sum;
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    batch_sizes_.push_back(rows);
+    return preds;
+  }
+
+  std::vector<int> BatchSizes() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return batch_sizes_;
+  }
+
+ private:
+  std::mutex mtx_;
+  std::vector<int> batch_sizes_;
+};
+
+// every request k is the row {k: k + 1}, return the seconds of the requests
+inline double RunRequests(MicroBatcher *batcher, const int num_requests) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<float> results(num_requests);
+  std::vector<std::thread> threads;
+  for (int k = 0; k < num_requests; ++k) {
+    threads.emplace_back([batcher, k, &results]() {
+      const std::vector<int32_t> indices{k};
+      const std::vector<float> values{float(k + 1)};
+      results[k] = batcher->Predict(indices, values);
+    });
+  }
+  for (std::thread &t : threads) t.join();
+  for (int k = 0; k < num_requests; ++k) {
+    EXPECT_EQ(results[k], float(k + 1)) << k;
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+TEST(TestMicroBatcher, flush_by_size) {
+  // 8 clients are connected, a batch is full before all of them wait
+  SumPredictor predictor;
+  MicroBatcher batcher(
+      [&predictor](const CSRMatrix<float> &X) { return predictor(X); }, 4,
+      10000000);
+  for (int i = 0; i < 8; ++i) batcher.AddClient();
+  ASSERT_LT(RunRequests(&batcher, 4), 5);
+  ASSERT_EQ(predictor.BatchSizes(), std::vector<int>{4});
+  const MicroBatcher::Stats stats = batcher.TakeStats();
+  ASSERT_EQ(stats.num_requests, 4);
+  ASSERT_EQ(stats.num_batches, 1);
+  ASSERT_EQ(stats.latencies.size(), 4);
+  for (int i = 0; i < 8; ++i) batcher.RemoveClient();
+}
+
+TEST(TestMicroBatcher, flush_by_deadline) {
+  // the other client doesn't send, the request waits for max_delay
+  SumPredictor predictor;
+  const int max_delay_us = 50000;
+  MicroBatcher batcher(
+      [&predictor](const CSRMatrix<float> &X) { return predictor(X); }, 256,
+      max_delay_us);
+  batcher.AddClient();
+  batcher.AddClient();
+  ASSERT_GE(RunRequests(&batcher, 1), max_delay_us * 1e-6);
+  ASSERT_EQ(predictor.BatchSizes(), std::vector<int>{1});
+  batcher.RemoveClient();
+  batcher.RemoveClient();
+}
+
+TEST(TestMicroBatcher, flush_when_all_clients_wait) {
+  SumPredictor predictor;
+  MicroBatcher batcher(
+      [&predictor](const CSRMatrix<float> &X) { return predictor(X); }, 256,
+      10000000);
+  for (int i = 0; i < 3; ++i) batcher.AddClient();
+  ASSERT_LT(RunRequests(&batcher, 3), 5);
+  ASSERT_EQ(predictor.BatchSizes(), std::vector<int>{3});
+  // a client leaves while the others wait
+  std::thread leaving([&batcher]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    batcher.RemoveClient();
+  });
+  ASSERT_LT(RunRequests(&batcher, 2), 5);
+  leaving.join();
+  ASSERT_EQ(predictor.BatchSizes(), (std::vector<int>{3, 2}));
+  batcher.RemoveClient();
+  batcher.RemoveClient();
+}
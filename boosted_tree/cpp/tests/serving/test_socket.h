@@ -0,0 +1,77 @@
+#pragma once
+
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../../src/serving/socket.h"
+
+TEST(TestServing, ParseLibSVMRow) {
+  std::vector<int32_t> indices;
+  std::vector<float> values;
+  ASSERT_TRUE(ParseLibSVMRow("1 0:1.5 3:-2\r", &indices, &values));
+  ASSERT_EQ(indices, (std::vector<int32_t>{0, 3}));
+  ASSERT_EQ(values, (std::vector<float>{1.5, -2}));
+  // the label is optional
+  ASSERT_TRUE(ParseLibSVMRow("\t2:1e-3  ", &indices, &values));
+  ASSERT_EQ(indices, (std::vector<int32_t>{2}));
+  ASSERT_EQ(values, (std::vector<float>{1e-3}));
+  ASSERT_TRUE(ParseLibSVMRow("", &indices, &values));
+  ASSERT_TRUE(indices.empty());
+  ASSERT_TRUE(values.empty());
+  for (const std::string line :
+       {"-1:2", "a:1", "1:", "1:2x", "0:1 2", "2147483648:1", "1 1:2:3"}) {
+    ASSERT_FALSE(ParseLibSVMRow(line, &indices, &values)) << line;
+  }
+}
+
+// the bytes of a binary request whose nnz field is nnz
+inline std::string BinaryRow(const uint32_t nnz,
+                             const std::vector<int32_t> &indices,
+                             const std::vector<float> &values) {
+  std::string buf(reinterpret_cast<const char *>(&nnz), sizeof(nnz));
+  for (size_t k = 0; k < indices.size(); ++k) {
+    buf.append(reinterpret_cast<const char *>(&indices[k]), sizeof(int32_t));
+    buf.append(reinterpret_cast<const char *>(&values[k]), sizeof(float));
+  }
+  return buf;
+}
+
+// read the binary requests in buf, return the status of every request until
+// the first one which isn't kOk
+inline std::vector<ReadStatus> ReadBinaryRows(const std::string &buf) {
+  int fds[2];
+  EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  EXPECT_TRUE(WriteAll(fds[1], buf.data(), buf.size()));
+  close(fds[1]);
+  SocketReader reader(fds[0]);
+  std::vector<int32_t> indices;
+  std::vector<float> values;
+  std::vector<ReadStatus> status;
+  do {
+    status.push_back(ReadBinaryRow(&reader, &indices, &values));
+  } while (status.back() == ReadStatus::kOk);
+  close(fds[0]);
+  return status;
+}
+
+TEST(TestServing, ReadBinaryRow) {
+  using S = ReadStatus;
+  ASSERT_EQ(ReadBinaryRows(BinaryRow(2, {0, 5}, {1, 2}) + BinaryRow(0, {}, {})),
+            (std::vector<S>{S::kOk, S::kOk, S::kClosed}));
+  // a truncated request
+  ASSERT_EQ(ReadBinaryRows(BinaryRow(2, {0}, {1})),
+            (std::vector<S>{S::kClosed}));
+  // nnz is bounded before the features are allocated
+  ASSERT_EQ(ReadBinaryRows(BinaryRow(kMaxRequestNNZ + 1, {}, {})),
+            (std::vector<S>{S::kBad}));
+  ASSERT_EQ(ReadBinaryRows(BinaryRow(0xFFFFFFFF, {}, {})),
+            (std::vector<S>{S::kBad}));
+  ASSERT_EQ(ReadBinaryRows(BinaryRow(1, {0}, {1}) + BinaryRow(2, {1, -3}, {1, 2})),
+            (std::vector<S>{S::kOk, S::kBad}));
+}
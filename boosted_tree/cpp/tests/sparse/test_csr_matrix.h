@@ -133,3 +133,30 @@ TEST(TestCSRRow, todense) {
               Vec<int>(mat[r].begin(), mat[r].end()).tovector());
   }
 }
+
+TEST(TestCSRRow, nonzero) {
+  std::vector<std::vector<int>> mat{{1, 0, 2}, {0, 0, 0}, {4, 5, 6}};
+  std::vector<dim_t> row;
+  std::vector<dim_t> col;
+  std::vector<int> data;
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      if (mat[r][c]) {
+        row.push_back(r);
+        col.push_back(c);
+        data.push_back(mat[r][c]);
+      }
+    }
+  }
+  CSRMatrix<int> smat(3, 3);
+  smat.reset(row, col, data);
+  for (int r = 0; r < 3; ++r) {
+    CSRRow<int> srow = smat[r];
+    std::vector<int> dense(3, 0);
+    for (dim_t i = 0; i < srow.nnz(); ++i) {
+      dense[srow.indices()[i]] = srow.values()[i];
+    }
+    ASSERT_EQ(dense, mat[r]);
+  }
+  ASSERT_EQ(smat[1].nnz(), 0);
+}
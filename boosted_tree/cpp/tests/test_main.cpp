@@ -1,8 +1,10 @@
 #include <gtest/gtest.h>
 
+#include "./boosted_tree/boosted_tree.h"
 #include "./dense/dense.h"
 #include "./io/io.h"
 #include "./quantile/quantile.h"
+#include "./serving/serving.h"
 #include "./sparse/sparse.h"
 
 int main(int argc, char **argv) {
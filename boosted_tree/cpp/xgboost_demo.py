@@ -37,6 +37,9 @@ evaluate(train_preds, dtrain.get_label(), 'Training')
 test_preds = bst.predict(dtest)
 evaluate(test_preds, dtest.get_label(), 'Testing')
 
+# load it by BoostedTree.load_xgboost_model with zero_as_missing = True
+bst.save_model('xgboost_model.json')
+
 num_trees = num_round
 print(f'Number of trees: {num_trees}')
 for i in range(num_trees):